@@ -0,0 +1,125 @@
+/*
+ * Firmware side of make bench-avr, in place of main() in main.c: brings the
+ * clock up like it, then calls every hot path in AVRSIM_BENCHES its number of
+ * times, each call between two writes of GPIOR0, where avrsim/run.c counts the
+ * cycles. Sleeping with interrupts disabled ends the simulation.
+ */
+
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "../datetime.h"
+#include "../display.h"
+#include "../events.h"
+#include "../rtc.h"
+#include "../twi.h"
+#include "../uart.h"
+#include "../host/datetime-ref.h"
+#include "benches.h"
+
+/* From main.c */
+void init(void);
+void update_display(void);
+void handle_command(char *msg);
+void process_events(void);
+void INT1_vect(void);
+
+static const u16 calls[] = {
+#define AVRSIM_BENCH_CALLS(id, name, n) n,
+    AVRSIM_BENCHES(AVRSIM_BENCH_CALLS)
+};
+
+static volatile u16 sink;
+
+static void command(const char *cmd)
+{
+    char buf[32];
+
+    strcpy(buf, cmd);
+    handle_command(buf);
+}
+
+static void run(u8 bench, u16 i)
+{
+    static struct date epoch = { .day = 1, .month = 1, .year = 1900 };
+    static struct date recent = { .day = 1, .month = 1, .year = 2019 };
+    static struct date today = { .day = 17, .month = 10, .year = 2026 };
+    struct datetime dt;
+
+    switch (bench) {
+    case AVRSIM_DIFF_1900_REF:
+        sink = ref_date_diff_days(&epoch, &today);
+        break;
+    case AVRSIM_DIFF_1900:
+        sink = date_diff_days(&epoch, &today);
+        break;
+    case AVRSIM_DIFF_2019_REF:
+        sink = ref_date_diff_days(&recent, &today);
+        break;
+    case AVRSIM_DIFF_2019:
+        sink = date_diff_days(&recent, &today);
+        break;
+    case AVRSIM_FROM_DAYS:
+        date_from_days(i * 701UL, &dt.date);
+        sink = dt.date.year;
+        break;
+    case AVRSIM_SHOWNUM:
+        display_shownum(1200 + i, true, true, 1);
+        display_wait();
+        break;
+    case AVRSIM_RTC_READ_TIME:
+        rtc_read_time(&dt.time);
+        break;
+    case AVRSIM_UPDATE_DISPLAY:
+        update_display();
+        display_wait();
+        break;
+    case AVRSIM_CMD_TG:
+        command("tg");
+        break;
+    case AVRSIM_CMD_DDS:
+        command("dds 01-01-1900 00:00:00");
+        break;
+    case AVRSIM_INT1_ISR:
+        INT1_vect();
+        events_take();
+        break;
+    case AVRSIM_INT1_TICK:
+        INT1_vect();
+        process_events();
+        display_wait();
+        break;
+    }
+}
+
+int main(void)
+{
+    init();
+    uart_init();
+    uart_set_recv_callback(handle_command);
+    twi_init();
+    rtc_init();
+    rtc_enable_notifier();
+    display_init();
+    sei();
+
+    for (u8 bench = 1; bench < AVRSIM_NUM_BENCHES; bench++) {
+        for (u16 i = 0; i < calls[bench - 1]; i++) {
+            /* Sending the output of the call before is not counted. */
+            while (!uart_tx_idle() || display_busy())
+                ;
+            GPIOR0 = bench;
+            run(bench, i);
+            GPIOR0 = 0;
+        }
+    }
+
+    cli();
+    sleep_enable();
+    sleep_cpu();
+    for (;;)
+        ;
+}
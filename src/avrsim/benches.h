@@ -0,0 +1,30 @@
+#ifndef AVRSIM_BENCHES_H
+#define AVRSIM_BENCHES_H
+
+/*
+ * The hot paths make bench-avr counts cycles of, as X(id, name, calls): run by
+ * avrsim/bench.c on the simulated AVR and named by avrsim/run.c, which counts.
+ * Each call starts with the UART and display idle and is counted until it
+ * returns; sending its output after that is not. The overhead of a call (an
+ * empty one) is taken off the others.
+ */
+#define AVRSIM_BENCHES(X) \
+    X(OVERHEAD,       "loop overhead",             1000) \
+    X(DIFF_1900_REF,  "date_diff_days 1900 (ref)", 2) \
+    X(DIFF_1900,      "date_diff_days 1900",       100) \
+    X(DIFF_2019_REF,  "date_diff_days 2019 (ref)", 10) \
+    X(DIFF_2019,      "date_diff_days 2019",       100) \
+    X(FROM_DAYS,      "date_from_days",            100) \
+    X(SHOWNUM,        "display_shownum + wait",    10) \
+    X(RTC_READ_TIME,  "rtc_read_time",             10) \
+    X(UPDATE_DISPLAY, "update_display",            10) \
+    X(CMD_TG,         "handle_command tg",         10) \
+    X(CMD_DDS,        "handle_command dds",        10) \
+    X(INT1_ISR,       "INT1_vect (ISR only)",      100) \
+    X(INT1_TICK,      "INT1 tick (time)",          10)
+
+/* Written to GPIOR0: a bench's number (from 1) before it, 0 after it. */
+#define AVRSIM_BENCH_NUM(id, name, calls) AVRSIM_##id,
+enum { AVRSIM_NONE, AVRSIM_BENCHES(AVRSIM_BENCH_NUM) AVRSIM_NUM_BENCHES };
+
+#endif
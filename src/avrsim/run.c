@@ -0,0 +1,211 @@
+/*
+ * Simulator side of make bench-avr: runs the firmware built with
+ * avrsim/bench.c under simavr and counts the cycles of every bench between its
+ * GPIOR0 marks. Reports them per call, and as time at F_CPU, on stdout and as
+ * JSON lines to the given file.
+ *
+ * simavr does not model the LIN/UART, so the little of it uart.c uses for
+ * sending is done here: a byte written to LINDAT is done after its time at the
+ * baud rate set up, which sets LTXOK and raises LIN_TC_vect. The TM1637 ACKs
+ * every byte (DIO is held low), and the RTC interrupt line is idle (high).
+ *
+ * Usage: run <mcu> <elf> [<json file>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_io.h>
+#include <sim_regbit.h>
+#include <sim_interrupts.h>
+#include <sim_cycle_timers.h>
+#include <avr_ioport.h>
+
+#include "benches.h"
+
+/* ATtiny87 data space addresses and vector number, from the datasheet. */
+#define GPIOR0      0x3e
+#define LINSIR      0xc9
+#define LINENIR     0xca
+#define LINERR      0xcb
+#define LINBTR      0xcc
+#define LINBRRL     0xcd
+#define LINBRRH     0xce
+#define LINDAT      0xd2
+#define LIN_TC_VECT 12
+
+#define LTXOK   1
+#define LENTXOK 1
+#define LERR    3
+
+#define PIN_DISP_DIO 'B', 4
+#define PIN_RTC_INT  'A', 3
+
+/* Give up after this much simulated time without a mark. */
+#define BENCH_MAX_S 60
+
+static const char *const names[] = {
+#define AVRSIM_BENCH_NAME(id, name, calls) name,
+    AVRSIM_BENCHES(AVRSIM_BENCH_NAME)
+};
+static const unsigned calls[] = {
+#define AVRSIM_BENCH_CALLS(id, name, n) n,
+    AVRSIM_BENCHES(AVRSIM_BENCH_CALLS)
+};
+
+static avr_cycle_count_t cycles[AVRSIM_NUM_BENCHES];
+static avr_cycle_count_t last_mark; /* Cycle of the last GPIOR0 write */
+static int bench;
+
+static avr_int_vector_t lin_tc = {
+    .vector = LIN_TC_VECT,
+    .enable = AVR_IO_REGBIT(LINENIR, LENTXOK),
+    .raised = AVR_IO_REGBIT(LINSIR, LTXOK),
+    .raise_sticky = 1, /* Cleared by writing it, like the flag */
+};
+
+static void mark_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    (void)param;
+    avr->data[addr] = v;
+    if (v && v < AVRSIM_NUM_BENCHES) {
+        bench = v;
+    } else if (!v && bench) {
+        cycles[bench] += avr->cycle - last_mark;
+        bench = 0;
+    }
+    last_mark = avr->cycle;
+}
+
+static avr_cycle_count_t tx_done(avr_t *avr, avr_cycle_count_t when,
+        void *param)
+{
+    (void)when;
+    (void)param;
+    avr_raise_interrupt(avr, &lin_tc);
+    return 0;
+}
+
+/* Start, 8 data and stop bits, with the bit time the registers set up. */
+static void lindat_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+        void *param)
+{
+    unsigned div = (avr->data[LINBRRH] << 8 | avr->data[LINBRRL]) + 1;
+
+    (void)param;
+    avr->data[addr] = v;
+    avr_cycle_timer_cancel(avr, tx_done, NULL);
+    avr_cycle_timer_register(avr, 10 * (avr->data[LINBTR] & 0x3f) * div,
+            tx_done, NULL);
+}
+
+/* The flags are cleared by writing ones to them, LERR along with LINERR. */
+static void linsir_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+        void *param)
+{
+    (void)param;
+    if (v & (1 << LTXOK))
+        avr_clear_interrupt(avr, &lin_tc);
+    if (v & (1 << LERR))
+        avr->data[LINERR] = 0;
+    avr->data[addr] &= ~(v & 0x0f);
+}
+
+/* Enabling the interrupt with the flag already set raises it. */
+static void linenir_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+        void *param)
+{
+    uint8_t was = avr->data[addr];
+
+    (void)param;
+    avr->data[addr] = v;
+    if ((v & ~was & (1 << LENTXOK)) && (avr->data[LINSIR] & (1 << LTXOK)))
+        avr_raise_interrupt(avr, &lin_tc);
+}
+
+static void pin_drive(avr_t *avr, char port, int bit, int level)
+{
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), bit),
+            level);
+}
+
+int main(int argc, char **argv)
+{
+    elf_firmware_t fw;
+    avr_t *avr;
+    FILE *json = NULL;
+    double overhead;
+    int state;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <mcu> <elf> [<json file>]\n", argv[0]);
+        return 1;
+    }
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(argv[2], &fw)) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[2]);
+        return 1;
+    }
+    avr = avr_make_mcu_by_name(argv[1]);
+    if (!avr) {
+        fprintf(stderr, "%s: simavr has no %s core\n", argv[0], argv[1]);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &fw);
+    avr->frequency = F_CPU;
+
+    avr_register_vector(avr, &lin_tc);
+    avr_register_io_write(avr, GPIOR0, mark_write, NULL);
+    avr_register_io_write(avr, LINDAT, lindat_write, NULL);
+    avr_register_io_write(avr, LINSIR, linsir_write, NULL);
+    avr_register_io_write(avr, LINENIR, linenir_write, NULL);
+    pin_drive(avr, PIN_DISP_DIO, 0);
+    pin_drive(avr, PIN_RTC_INT, 1);
+
+    do {
+        state = avr_run(avr);
+        if (avr->cycle - last_mark > (avr_cycle_count_t)BENCH_MAX_S * F_CPU) {
+            fprintf(stderr, "%s: stuck in %s\n", argv[0],
+                    bench ? names[bench - 1] : "setup");
+            return 1;
+        }
+    } while (state != cpu_Done && state != cpu_Crashed);
+    if (state == cpu_Crashed) {
+        fprintf(stderr, "%s: firmware crashed at %#x\n", argv[0],
+                (unsigned)avr->pc);
+        return 1;
+    }
+
+    if (argc > 3) {
+        json = fopen(argv[3], "w");
+        if (!json) {
+            perror(argv[3]);
+            return 1;
+        }
+        fprintf(json, "{\"version\": \"%s\", \"f_cpu\": %lu, \"mcu\": \"%s\"}\n",
+                VERSION, (unsigned long)F_CPU, argv[1]);
+    }
+
+    printf("%-28s %9s %14s %14s\n", "benchmark (AVR)", "calls",
+            "cycles/call", "us/call");
+    overhead = (double)cycles[AVRSIM_OVERHEAD] / calls[AVRSIM_OVERHEAD - 1];
+    for (int i = 1; i < AVRSIM_NUM_BENCHES; i++) {
+        double c = (double)cycles[i] / calls[i - 1];
+
+        if (i != AVRSIM_OVERHEAD)
+            c -= overhead;
+        printf("%-28s %9u %14.1f %14.2f\n", names[i - 1], calls[i - 1], c,
+                c * 1e6 / F_CPU);
+        if (json)
+            fprintf(json, "{\"bench\": \"%s\", \"calls\": %u, "
+                    "\"cycles\": %.1f, \"us\": %.2f}\n", names[i - 1],
+                    calls[i - 1], c, c * 1e6 / F_CPU);
+    }
+    if (json)
+        fclose(json);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+
+#include "clock.h"
+#include "datetime.h"
+#include "rtc.h"
+
+static bool soft;
+static bool valid;
+static bool skip_tick; /* The next tick is for the minute we already read */
+static u8 since_sync;
+static struct datetime now;
+static struct clock_stats stats;
+
+void clock_set_soft(bool enabled)
+{
+    soft = enabled;
+    valid = false;
+}
+
+bool clock_is_soft(void)
+{
+    return soft;
+}
+
+static s32 seconds_of_day(struct time *time)
+{
+    return time->hour * 3600L + time->min * 60 + time->sec;
+}
+
+/* a - b in seconds, saturated to the range of an s16. */
+static s16 seconds_between(struct datetime *a, struct datetime *b)
+{
+    s32 days = date_to_days(&a->date) - date_to_days(&b->date);
+    s32 secs;
+
+    if (days > 1 || days < -1)
+        return days > 0 ? INT16_MAX : -INT16_MAX;
+
+    secs = days * 86400 + seconds_of_day(&a->time) - seconds_of_day(&b->time);
+    if (secs > INT16_MAX)
+        return INT16_MAX;
+    if (secs < -INT16_MAX)
+        return -INT16_MAX;
+    return secs;
+}
+
+void clock_invalidate(void)
+{
+    valid = false;
+}
+
+static void resync(void)
+{
+    struct datetime rtc;
+    u8 status;
+
+    rtc_read_datetime(&rtc, &status, NULL);
+
+    if (valid) {
+        stats.last_drift = seconds_between(&now, &rtc);
+        if (abs(stats.last_drift) > stats.max_drift)
+            stats.max_drift = abs(stats.last_drift);
+    }
+    stats.resyncs++;
+
+    /*
+     * If the alarm is still pending, the time we just read already includes
+     * the minute that its tick is for.
+     */
+    skip_tick = status & RTC_STATUS_ALARM;
+    now = rtc;
+    valid = true;
+    since_sync = 0;
+}
+
+/* The RTC alarm fires at the start of every minute. */
+void clock_minute_tick(void)
+{
+    if (!soft || !valid)
+        return;
+    if (skip_tick) {
+        skip_tick = false;
+        return;
+    }
+
+    now.time.sec = 0;
+    if (++now.time.min == 60) {
+        now.time.min = 0;
+        if (++now.time.hour == 24) {
+            now.time.hour = 0;
+            date_next(&now.date);
+        }
+    }
+    since_sync++;
+}
+
+static bool need_resync(void)
+{
+    return !valid || since_sync >= CLOCK_RESYNC_MINUTES;
+}
+
+void clock_read_time(struct time *ret)
+{
+    if (!soft) {
+        rtc_read_time(ret);
+        return;
+    }
+    if (need_resync())
+        resync();
+    *ret = now.time;
+}
+
+void clock_read_date(struct date *ret)
+{
+    if (!soft) {
+        rtc_read_date(ret);
+        return;
+    }
+    if (need_resync())
+        resync();
+    *ret = now.date;
+}
+
+void clock_get_stats(struct clock_stats *ret)
+{
+    *ret = stats;
+}
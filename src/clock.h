@@ -0,0 +1,33 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+
+/*
+ * Date and time as seen by the rest of the firmware. By default every read
+ * goes to the RTC. In soft mode a copy is kept in RAM, advanced by the minute
+ * alarm and only resynchronised from the RTC every CLOCK_RESYNC_MINUTES (or
+ * after the RTC is written), so reads are usually free.
+ *
+ * The soft copy has minute resolution: reads that need the seconds should go
+ * to the RTC directly.
+ */
+#ifndef CLOCK_RESYNC_MINUTES
+# define CLOCK_RESYNC_MINUTES 60
+#endif
+
+struct clock_stats {
+    u16 resyncs;
+    s16 last_drift; /* Soft copy minus RTC at the last resync, in seconds */
+    s16 max_drift;  /* Largest absolute drift seen */
+};
+
+void clock_set_soft(bool enabled);
+bool clock_is_soft(void);
+void clock_minute_tick(void);
+void clock_invalidate(void);
+void clock_read_time(struct time *ret);
+void clock_read_date(struct date *ret);
+void clock_get_stats(struct clock_stats *ret);
+
+#endif
@@ -1,17 +1,464 @@
 #!/usr/bin/env python3
 
 import argparse
+import concurrent.futures
+import glob
 import serial
+import shlex
+import struct
+import sys
 import time
 
 DEFAULT_PORT = '/dev/ttyUSB0'
 DEFAULT_BAUD = 9600
+FLEET_PORTS = ['/dev/ttyUSB*', '/dev/ttyACM*']
 
-def communicate(cmd, port, baudrate):
-    with serial.Serial(port, baudrate) as ser:
-        ser.write(cmd + b'\n')
-        ser.readline()  # Command we sent
-        print(ser.readline().decode('utf-8').strip())
+# Binary protocol, see proto.h.
+PROTO_SYNC = 0xa5
+PROTO_OP_VERSION = 0x01
+PROTO_OP_TIME_GET = 0x02
+PROTO_OP_TIME_SET = 0x03
+PROTO_OP_DATE_GET = 0x04
+PROTO_OP_DATE_SET = 0x05
+PROTO_OP_DATETIME_GET = 0x06
+PROTO_OP_DATEDIFF_GET = 0x07
+PROTO_OP_DATEDIFF_SET = 0x08
+PROTO_OP_DATEDIFF_ENABLE = 0x09
+PROTO_OP_BRIGHTNESS_GET = 0x0a
+PROTO_OP_BRIGHTNESS_SET = 0x0b
+PROTO_OP_TEMP_GET = 0x0c
+PROTO_OP_SOFT_CLOCK = 0x0d
+PROTO_OP_CLOCK_STATS = 0x0e
+PROTO_OP_UART_STATS = 0x0f
+PROTO_OP_POWER_STATS = 0x10
+PROTO_OP_SAVE = 0x11
+PROTO_OP_TEXT = 0x12
+PROTO_OP_BAUD = 0x13
+PROTO_OP_RAM_STATS = 0x14
+PROTO_OP_ISR_STATS = 0x15
+PROTO_OP_ISR_STATS_RESET = 0x16
+PROTO_OP_DATETIME_SET = 0x17
+PROTO_OP_PING = 0x18
+PROTO_OP_AGING_GET = 0x19
+PROTO_OP_AGING_SET = 0x1a
+PROTO_OP_SHOW_TEXT = 0x1b
+
+PROTO_MAX_LEN = 32
+PROTO_MAX_RESP = 64
+
+# Characters of text the display takes, scrolling when over 4.
+DISPLAY_TEXT_MAX = 16
+
+# Frequency change (ppm) per step of the DS3231's aging offset.
+AGING_PPM = 0.1
+
+# Histograms of PROTO_OP_ISR_STATS, in order (see isrstats.h).
+ISR_STATS_NAMES = ['int1', 'timer1', 'lin', 'pcint0', 'minute', 'uartrx',
+                   'frame']
+
+PROTO_ERRORS = ['ok', 'unknown opcode', 'truncated argument', 'bad argument',
+                'response full', 'bad CRC']
+
+def fmt_time(b):
+    return '%02d:%02d:%02d' % (b[0], b[1], b[2])
+
+def fmt_date(b):
+    return '%02d-%02d-%04d' % (b[0], b[1], b[2] | b[3] << 8)
+
+def fmt_datetime(b):
+    return fmt_date(b) + ' ' + fmt_time(b[4:])
+
+def fmt_isr_stats(b):
+    tick, hist_max = b[0], struct.unpack('<H', b[1:3])[0]
+    counts = struct.unpack('<8H', b[3:])
+    return 'max %u us: %s' % (tick * hist_max, ' '.join(map(str, counts)))
+
+def fmt_clock(b):
+    soft, resyncs, drift, max_drift = struct.unpack('<BHhh', b)
+    return 'Clock %s resyncs %u drift %d s max %d s' % (
+            'soft' if soft else 'rtc', resyncs, drift, max_drift)
+
+# Result size and formatting per opcode.
+PROTO_RESULTS = {
+    PROTO_OP_VERSION: (16, lambda b: 'Version ' + b.rstrip(b'\0').decode()),
+    PROTO_OP_TIME_GET: (3, fmt_time),
+    PROTO_OP_TIME_SET: (3, fmt_time),
+    PROTO_OP_DATE_GET: (4, fmt_date),
+    PROTO_OP_DATE_SET: (4, fmt_date),
+    PROTO_OP_DATETIME_GET: (7, fmt_datetime),
+    PROTO_OP_DATEDIFF_GET: (7, fmt_datetime),
+    PROTO_OP_DATEDIFF_SET: (7, fmt_datetime),
+    PROTO_OP_DATEDIFF_ENABLE: (1, lambda b: 'Datediff %s' % (
+        'enabled' if b[0] else 'disabled')),
+    PROTO_OP_BRIGHTNESS_GET: (1, lambda b: 'Brightness %u/7' % b[0]),
+    PROTO_OP_BRIGHTNESS_SET: (1, lambda b: 'Brightness %u/7' % b[0]),
+    PROTO_OP_TEMP_GET: (2, lambda b: 'Temp %d.%u C' % struct.unpack('<bB', b)),
+    PROTO_OP_SOFT_CLOCK: (1, lambda b: 'Soft clock %s' % (
+        'enabled' if b[0] else 'disabled')),
+    PROTO_OP_CLOCK_STATS: (7, fmt_clock),
+    PROTO_OP_UART_STATS: (8, lambda b:
+        'UART overrun %u overflow %u dropped %u txdrop %u' %
+        struct.unpack('<4H', b)),
+    PROTO_OP_POWER_STATS: (6, lambda b:
+        'Power idle %u pdown %u uartwake %u' % struct.unpack('<3H', b)),
+    PROTO_OP_SAVE: (4, lambda b:
+        'Settings slot %u seq %u writes %u' % struct.unpack('<BBH', b)),
+    PROTO_OP_TEXT: (0, None),
+    PROTO_OP_BAUD: (4, None),
+    PROTO_OP_ISR_STATS: (19, fmt_isr_stats),
+    PROTO_OP_ISR_STATS_RESET: (0, lambda b: 'Stats reset'),
+    PROTO_OP_DATETIME_SET: (7, fmt_datetime),
+    PROTO_OP_PING: (7, None),
+    PROTO_OP_AGING_GET: (1, lambda b: 'Aging %d' % struct.unpack('<b', b)),
+    PROTO_OP_AGING_SET: (1, lambda b: 'Aging %d' % struct.unpack('<b', b)),
+    PROTO_OP_SHOW_TEXT: (0, None),
+    PROTO_OP_RAM_STATS: (18, lambda b:
+        'RAM data %u stack max %u unused %u free %u\n'
+        'ISR depth int1 %u timer1 %u lin %u pcint0 %u timer0 %u' %
+        struct.unpack('<9H', b)),
+}
+
+def crc8(data, crc=0):
+    """CRC-8 CCITT (polynomial 0x07), as _crc8_ccitt_update() in avr-libc."""
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07 if crc & 0x80 else crc << 1) & 0xff
+    return crc
+
+class ClockError(IOError):
+    """A request was answered with an error status."""
+    def __init__(self, op, status):
+        self.op, self.status = op, status
+        super().__init__('Request 0x%02x failed: %s' % (op,
+            PROTO_ERRORS[status] if status < len(PROTO_ERRORS) else status))
+
+class ClockTimeout(IOError):
+    """No (complete) response in time. The session is unusable after this."""
+
+def make_frame(requests):
+    payload = b''.join(bytes([op]) + arg for op, arg in requests)
+    frame = bytes([len(payload)]) + payload
+    return bytes([PROTO_SYNC]) + frame + bytes([crc8(frame)])
+
+def parse_response(requests, resp):
+    """
+    Match the entries of a response payload to the requests of its frame, and
+    return their results. Raises ClockError for the first failed request.
+    """
+    results = []
+    for op, arg in requests:
+        if len(resp) < 2:
+            raise IOError('Response ends before request 0x%02x' % op)
+        if resp[1]:
+            raise ClockError(resp[0], resp[1])
+        if resp[0] != op:
+            raise IOError('Response 0x%02x to request 0x%02x' % (resp[0], op))
+        size = PROTO_RESULTS[op][0]
+        results.append(resp[2:2 + size])
+        resp = resp[2 + size:]
+    return results
+
+def split_frames(requests):
+    """Split requests over as few frames as their requests and results fit."""
+    frames, cur, req_len, resp_len = [], [], 0, 0
+    for op, arg in requests:
+        r, p = 1 + len(arg), 2 + PROTO_RESULTS[op][0]
+        if cur and (req_len + r > PROTO_MAX_LEN or
+                    resp_len + p > PROTO_MAX_RESP):
+            frames.append(cur)
+            cur, req_len, resp_len = [], 0, 0
+        cur.append((op, arg))
+        req_len += r
+        resp_len += p
+    if cur:
+        frames.append(cur)
+    return frames
+
+def format_result(op, result):
+    fmt = PROTO_RESULTS[op][1]
+    return fmt(result) if fmt else None
+
+def baud_request(baudrate):
+    return (PROTO_OP_BAUD, struct.pack('<I', baudrate))
+
+class Clock:
+    """
+    A session with the clock over a single open serial port, in binary mode
+    unless text is set. A baudrate other than the default is switched to when
+    the session starts, and back when it is closed.
+
+    Sessions are meant to be short: the clock powers down after a few idle
+    minutes (power.h) and is back in text mode at the default baudrate then.
+
+        with Clock('/dev/ttyUSB0') as clock:
+            clock.execute([(PROTO_OP_BRIGHTNESS_SET, b'\3'),
+                           (PROTO_OP_SAVE, b'')])
+    """
+    def __init__(self, port=DEFAULT_PORT, baudrate=DEFAULT_BAUD, timeout=1,
+                 text=False):
+        self.port, self.baudrate, self.timeout = port, baudrate, timeout
+        self.text_mode = text
+        self.ser = None
+
+    def __enter__(self):
+        self.open()
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        # After a timeout the clock is in an unknown state, so just let go.
+        if isinstance(exc, ClockTimeout):
+            self.ser.close()
+            self.ser = None
+        self.close()
+
+    def open(self):
+        self.ser = serial.Serial(self.port, DEFAULT_BAUD, timeout=self.timeout)
+        self._wake()
+        if self.text_mode:
+            if self.baudrate != DEFAULT_BAUD:
+                reply = self.text('baud %d' % self.baudrate)
+                if reply != ['Baud %d' % self.baudrate]:
+                    raise IOError(' '.join(reply))
+                self.ser.baudrate = self.baudrate
+            return
+        self.ser.write(b'bin\n')
+        time.sleep(0.05)
+        self.ser.reset_input_buffer()
+        if self.baudrate != DEFAULT_BAUD:
+            self.execute([baud_request(self.baudrate)])
+
+    def close(self):
+        if not self.ser:
+            return
+        try:
+            if self.text_mode:
+                if self.baudrate != DEFAULT_BAUD:
+                    self.text('baud %d' % DEFAULT_BAUD)
+            else:
+                back = [(PROTO_OP_TEXT, b'')]
+                if self.ser.baudrate != DEFAULT_BAUD:
+                    back.insert(0, baud_request(DEFAULT_BAUD))
+                self._transfer([back])
+        finally:
+            self.ser.close()
+            self.ser = None
+
+    def _wake(self):
+        # The clock may be in power-down, where the first byte only wakes it
+        # up and is lost. Send an empty line and drop its echo (if it was
+        # awake).
+        self.ser.write(b'\n')
+        time.sleep(0.05)
+        self.ser.reset_input_buffer()
+
+    def _read(self, n):
+        data = self.ser.read(n)
+        if len(data) != n:
+            raise ClockTimeout('No response' if not data else
+                               'Truncated response')
+        return data
+
+    def _read_sync(self):
+        deadline = time.monotonic() + self.timeout
+        while self._read(1)[0] != PROTO_SYNC:
+            if time.monotonic() > deadline:
+                raise ClockTimeout('No response')
+
+    def _read_payload(self):
+        length = self._read(1)
+        payload = self._read(length[0]) if length[0] else b''
+        if self._read(1)[0] != crc8(length + payload):
+            raise IOError('Bad CRC in response')
+        return payload
+
+    def _transfer(self, frames):
+        """
+        Send frames and return the response payloads. A frame is sent as soon
+        as the previous response starts, except after a frame switching the
+        baudrate or mode (which happens once its response is out).
+        """
+        payloads, sent = [], 1
+        self.ser.write(make_frame(frames[0]))
+        for i, frame in enumerate(frames):
+            ops = [op for op, arg in frame]
+            barrier = PROTO_OP_BAUD in ops or PROTO_OP_TEXT in ops
+            self._read_sync()
+            if not barrier and sent < len(frames):
+                self.ser.write(make_frame(frames[sent]))
+                sent += 1
+            payloads.append(self._read_payload())
+            if PROTO_OP_BAUD in ops:
+                arg = frame[ops.index(PROTO_OP_BAUD)][1]
+                self.ser.flush()
+                self.ser.baudrate = struct.unpack('<I', arg)[0]
+            if sent == i + 1 and sent < len(frames):
+                self.ser.write(make_frame(frames[sent]))
+                sent += 1
+        return payloads
+
+    def execute(self, requests):
+        """
+        Send a list of (opcode, argument) requests, pipelined over as few
+        frames as they fit in, and return their results (bytes) in the same
+        order. Raises ClockError for the first failed request; the ones after
+        it in its frame are not executed, those in later frames may be.
+        """
+        requests = list(requests)
+        if any(op == PROTO_OP_TEXT for op, arg in requests):
+            raise ValueError('Text mode is left by closing the session')
+        frames = split_frames(requests)
+        results = []
+        for frame, payload in zip(frames, self._transfer(frames)):
+            results += parse_response(frame, payload)
+        return results
+
+    def text(self, cmd, quiet=0.1):
+        """
+        Send a text command and return its reply lines (any sent within quiet
+        seconds after the first one).
+        """
+        self.ser.write(cmd.encode('utf-8') + b'\n')
+        self.ser.readline()  # Command we sent
+        line = self.ser.readline()
+        if not line:
+            raise ClockTimeout('No response')
+        lines = [line.decode('utf-8').strip()]
+        self.ser.timeout = quiet
+        try:
+            lines += [l.decode('utf-8').strip()
+                      for l in iter(self.ser.readline, b'')]
+        finally:
+            self.ser.timeout = self.timeout
+        return lines
+
+def pack_datetime(t):
+    return (struct.pack('<BBH', t.tm_mday, t.tm_mon, t.tm_year) +
+            bytes([t.tm_hour, t.tm_min, t.tm_sec]))
+
+def unpack_datetime(b):
+    """Seconds since the epoch of a date, time result (in local time)."""
+    day, month, year = struct.unpack('<BBH', b[:4])
+    return time.mktime((year, month, day, b[4], b[5], b[6], 0, 0, -1))
+
+def wait_until(t):
+    """Sleep until time.time() reaches t, busy-waiting the last bit of it."""
+    while True:
+        left = t - time.time()
+        if left <= 0:
+            return
+        if left > 0.002:
+            time.sleep(left - 0.002)
+
+# Argument of the PROTO_OP_PING requests that measure the latency.
+PING_ARG = bytes(7)
+
+def frame_latency(clock, samples=5):
+    """
+    Time (s) from sending a PROTO_OP_DATETIME_SET frame to the clock handling
+    it: half the shortest round trip of a PROTO_OP_PING, whose request and
+    response are as long.
+    """
+    rtt = float('inf')
+    for _ in range(samples):
+        start = time.time()
+        clock.execute([(PROTO_OP_PING, PING_ARG)])
+        rtt = min(rtt, time.time() - start)
+    return rtt / 2
+
+def measure_offset(clock, latency, timeout=3):
+    """
+    Offset (s) of the clock from the host clock, and the uncertainty of it,
+    from between which two reads of the clock its seconds roll over.
+    """
+    request = [(PROTO_OP_DATETIME_GET, b'')]
+    # Its frame is shorter than a ping's by the difference in arguments, at
+    # 10 bits a byte.
+    shorter = len(PING_ARG) - len(request[0][1])
+    latency = max(latency - shorter * 10 / clock.ser.baudrate, 0)
+    prev = None
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        start = time.time()
+        secs = unpack_datetime(clock.execute(request)[0])
+        at = start + latency
+        if prev and secs != prev[1]:
+            # Second secs of the clock started between the two reads.
+            return secs - (prev[0] + at) / 2, (at - prev[0]) / 2
+        prev = (at, secs)
+    raise IOError('Clock does not tick')
+
+def set_clock(clock):
+    """
+    Set the clock to the host's local time. Returns the date and time read
+    back, and the offset (s) that remains and its uncertainty.
+
+    The frame is sent ahead of a second boundary of the host clock by the
+    measured latency. The clock writes the time as soon as it has the frame,
+    which restarts the second of the DS3231 at that moment.
+    """
+    latency = frame_latency(clock)
+    second = int(time.time() + latency + 0.01) + 1
+    wait_until(second - latency)
+    result = clock.execute([(PROTO_OP_DATETIME_SET,
+                             pack_datetime(time.localtime(second)))])[0]
+    offset, error = measure_offset(clock, latency)
+    return result, offset, error
+
+def set_clock_text(clock):
+    """Set the clock with the dts text command, timed like set_clock()."""
+    second = int(time.time() + 0.01) + 1
+    line = time.strftime('dts %d-%m-%Y %H:%M:%S', time.localtime(second))
+    # The clock handles the line once its newline is in.
+    wait_until(second - (len(line) + 1) * 10 / clock.ser.baudrate)
+    return clock.text(line)
+
+def calibrate(clock, duration, interval, dry_run):
+    """
+    Measure how fast the clock runs against the host clock, from its offset
+    sampled every interval seconds for duration seconds, and correct its aging
+    offset for that.
+    """
+    latency = frame_latency(clock)
+    samples = []
+    start = time.time()
+    while True:
+        offset, error = measure_offset(clock, latency)
+        t = time.time() - start
+        samples.append((t, offset, error))
+        print('%7.0f s offset %+.1f ms (+/- %.1f ms)' % (t, offset * 1000,
+                                                         error * 1000))
+        if t >= duration:
+            break
+        time.sleep(min(interval, duration - t))
+
+    # Least squares fit of the offsets, and the error if only the first and
+    # last sample were right to their uncertainty.
+    n = len(samples)
+    mean_t = sum(s[0] for s in samples) / n
+    mean_o = sum(s[1] for s in samples) / n
+    slope = (sum((t - mean_t) * (o - mean_o) for t, o, e in samples) /
+             sum((t - mean_t) ** 2 for t, o, e in samples))
+    span = samples[-1][0] - samples[0][0]
+    ppm = slope * 1e6
+    ppm_error = (samples[0][2] + samples[-1][2]) / span * 1e6
+    print('Drift %+.2f ppm (+/- %.2f ppm)' % (ppm, ppm_error))
+
+    # A clock that runs fast needs a larger offset, which slows it down. Drift
+    # within the error is not corrected; measure longer for that.
+    old = struct.unpack('<b', clock.execute([(PROTO_OP_AGING_GET, b'')])[0])[0]
+    new = old
+    if abs(ppm) > ppm_error:
+        new = max(-128, min(127, old + round(ppm / AGING_PPM)))
+    if new == old or dry_run:
+        print('Aging %d, would be %d' % (old, new) if dry_run else
+              'Aging %d' % old)
+        return
+    clock.execute([(PROTO_OP_AGING_SET, struct.pack('<b', new))])
+    print('Aging %d -> %d' % (old, new))
+
+# Both set the date and the time, from the host's clock.
+SET_CLOCK_COMMANDS = ['set-time', 'set-date']
 
 def datetime(s):
     try:
@@ -27,16 +474,25 @@ def datetime(s):
         raise argparse.ArgumentTypeError('Year must be between 1900 and 2100.')
     return s
 
-def main():
-    parser = argparse.ArgumentParser(description='Control SimpleClock via UART')
-    parser.add_argument('-p', '--port', nargs=1, default=DEFAULT_PORT)
-    parser.add_argument('-b', '--baud', nargs=1, default=DEFAULT_BAUD)
-    subparsers = parser.add_subparsers(help='Command', dest='command')
-    subparsers.required = True
+def aging(s):
+    value = int(s)
+    if not -128 <= value <= 127:
+        raise argparse.ArgumentTypeError('Aging offset is -128 to 127.')
+    return value
+
+def display_text(s):
+    if not 0 < len(s) <= DISPLAY_TEXT_MAX or not s.isascii() or \
+            not s.isprintable():
+        raise argparse.ArgumentTypeError(
+            'Text is 1 to %d printable ASCII characters.' % DISPLAY_TEXT_MAX)
+    return s
+
+def add_commands(subparsers):
     subparsers.add_parser('set-time')
     subparsers.add_parser('get-time')
     subparsers.add_parser('set-date')
     subparsers.add_parser('get-date')
+    subparsers.add_parser('get-datetime')
     subparsers.add_parser('enable-datediff')
     subparsers.add_parser('disable-datediff')
     subparsers.add_parser('set-datediff').add_argument('target', type=datetime)
@@ -44,15 +500,26 @@ def main():
     subparsers.add_parser('set-brightness').add_argument('brightness', type=int)
     subparsers.add_parser('get-brightness')
     subparsers.add_parser('get-temp')
+    subparsers.add_parser('get-aging')
+    subparsers.add_parser('set-aging').add_argument('aging', type=aging)
+    subparsers.add_parser('show-text').add_argument('message', type=display_text)
+    subparsers.add_parser('show-clock')
     subparsers.add_parser('get-version')
+    subparsers.add_parser('get-uart-stats')
+    subparsers.add_parser('enable-soft-clock')
+    subparsers.add_parser('disable-soft-clock')
+    subparsers.add_parser('get-clock-stats')
+    subparsers.add_parser('get-power-stats')
+    subparsers.add_parser('save-settings')
+    subparsers.add_parser('get-ram-stats')
+    subparsers.add_parser('get-isr-stats')
+    subparsers.add_parser('reset-isr-stats')
 
-    args = parser.parse_args()
-
-    cmds = {
-        'set-time': 'ts ' + time.strftime('%H:%M:%S'),
+def text_command(args):
+    return {
         'get-time': 'tg',
-        'set-date': 'ds ' + time.strftime('%d:%m:%Y'),
         'get-date': 'dg',
+        'get-datetime': 'dtg',
         'enable-datediff': 'dde 1',
         'disable-datediff': 'dde 0',
         'set-datediff': 'dds ' + getattr(args, 'target', ''),
@@ -60,12 +527,248 @@ def main():
         'set-brightness': 'bs %d' % getattr(args, 'brightness', 0),
         'get-brightness': 'bg',
         'get-temp': 'temp',
-        'get-version': 'ver'
-    }
+        'get-aging': 'ag',
+        'set-aging': 'as %d' % getattr(args, 'aging', 0),
+        'show-text': 'show ' + getattr(args, 'message', ''),
+        'show-clock': 'show',
+        'get-version': 'ver',
+        'get-uart-stats': 'uart',
+        'enable-soft-clock': 'clk 1',
+        'disable-soft-clock': 'clk 0',
+        'get-clock-stats': 'clk',
+        'get-power-stats': 'pwr',
+        'save-settings': 'save',
+        'get-ram-stats': 'ram',
+        'get-isr-stats': 'stats',
+        'reset-isr-stats': 'stats reset',
+    }[args.command]
+
+def command_requests(args):
+    target = time.strptime(getattr(args, 'target', '01-01-1900'),
+                           '%d-%m-%Y %H:%M:%S' if hasattr(args, 'target')
+                           else '%d-%m-%Y')
+    return {
+        'get-time': lambda: [(PROTO_OP_TIME_GET, b'')],
+        'get-date': lambda: [(PROTO_OP_DATE_GET, b'')],
+        'get-datetime': lambda: [(PROTO_OP_DATETIME_GET, b'')],
+        'enable-datediff': lambda: [(PROTO_OP_DATEDIFF_ENABLE, b'\1')],
+        'disable-datediff': lambda: [(PROTO_OP_DATEDIFF_ENABLE, b'\0')],
+        'set-datediff': lambda: [(PROTO_OP_DATEDIFF_SET,
+                                  pack_datetime(target))],
+        'get-datediff': lambda: [(PROTO_OP_DATEDIFF_GET, b'')],
+        'set-brightness': lambda: [(PROTO_OP_BRIGHTNESS_SET,
+                                    bytes([args.brightness & 0x7]))],
+        'get-brightness': lambda: [(PROTO_OP_BRIGHTNESS_GET, b'')],
+        'get-temp': lambda: [(PROTO_OP_TEMP_GET, b'')],
+        'get-aging': lambda: [(PROTO_OP_AGING_GET, b'')],
+        'set-aging': lambda: [(PROTO_OP_AGING_SET,
+                               struct.pack('<b', args.aging))],
+        'show-text': lambda: [(PROTO_OP_SHOW_TEXT, args.message.encode('ascii')
+                               .ljust(DISPLAY_TEXT_MAX, b'\0'))],
+        'show-clock': lambda: [(PROTO_OP_SHOW_TEXT,
+                                bytes(DISPLAY_TEXT_MAX))],
+        'get-version': lambda: [(PROTO_OP_VERSION, b'')],
+        'get-uart-stats': lambda: [(PROTO_OP_UART_STATS, b'')],
+        'enable-soft-clock': lambda: [(PROTO_OP_SOFT_CLOCK, b'\1')],
+        'disable-soft-clock': lambda: [(PROTO_OP_SOFT_CLOCK, b'\0')],
+        'get-clock-stats': lambda: [(PROTO_OP_CLOCK_STATS, b'')],
+        'get-power-stats': lambda: [(PROTO_OP_POWER_STATS, b'')],
+        'save-settings': lambda: [(PROTO_OP_SAVE, b'')],
+        'get-ram-stats': lambda: [(PROTO_OP_RAM_STATS, b'')],
+        'get-isr-stats': lambda: [(PROTO_OP_ISR_STATS, bytes([i]))
+                                  for i in range(len(ISR_STATS_NAMES))],
+        'reset-isr-stats': lambda: [(PROTO_OP_ISR_STATS_RESET, b'')],
+    }[args.command]()
+
+def format_results(args, requests, results):
+    lines = [format_result(op, res) for (op, arg), res in zip(requests, results)]
+    if args.command == 'get-isr-stats':
+        lines = ['%-6s %s' % l for l in zip(ISR_STATS_NAMES, lines)]
+    return [l for l in lines if l is not None]
+
+def read_batch(parser, f):
+    """Parse a file of commands (as on the command line), one per line."""
+    batch = []
+    for n, line in enumerate(f, 1):
+        words = shlex.split(line, comments=True)
+        if not words:
+            continue
+        try:
+            batch.append(parser.parse_args(words))
+        except SystemExit:
+            raise SystemExit('%s:%d: invalid command' % (f.name, n))
+    return batch
+
+def run_requests(clock, batch, prefix):
+    # All requests go out in one pipelined execute, the results are matched
+    # back to the commands by their number of requests.
+    requests = [command_requests(args) for args in batch]
+    results = clock.execute(r for reqs in requests for r in reqs)
+    for args, reqs in zip(batch, requests):
+        lines = format_results(args, reqs, results[:len(reqs)])
+        results = results[len(reqs):]
+        for line in lines:
+            print(prefix(args) + line)
+
+def run(clock, batch, prefix):
+    if clock.text_mode:
+        for args in batch:
+            if args.command in SET_CLOCK_COMMANDS:
+                lines = set_clock_text(clock)
+            else:
+                lines = clock.text(text_command(args))
+            for line in lines:
+                print(prefix(args) + line)
+        return
+
+    # Setting the clock is timed, so it is done on its own in between.
+    pending = []
+    for args in batch + [None]:
+        if args and args.command not in SET_CLOCK_COMMANDS:
+            pending.append(args)
+            continue
+        if pending:
+            run_requests(clock, pending, prefix)
+            pending = []
+        if args:
+            result, offset, error = set_clock(clock)
+            print(prefix(args) + fmt_datetime(result))
+            print(prefix(args) + 'Offset %+.1f ms (+/- %.1f ms)' %
+                  (offset * 1000, error * 1000))
+
+def provision(port, args):
+    """
+    Set the date and time (and brightness) of the clock on port, check how far
+    off it is after that and its version, and return a report of it as a dict.
+    """
+    report = {'port': port, 'ok': False, 'version': '', 'offset': None,
+              'error': ''}
+    start = time.monotonic()
+    try:
+        with Clock(port, args.baud, args.timeout) as clock:
+            requests = [(PROTO_OP_VERSION, b'')]
+            if args.brightness is not None:
+                requests.append((PROTO_OP_BRIGHTNESS_SET,
+                                 bytes([args.brightness])))
+            if args.save:
+                requests.append((PROTO_OP_SAVE, b''))
+            results = clock.execute(requests)
+            report['version'] = results[0].rstrip(b'\0').decode()
+            result, offset, error = set_clock(clock)
+            report['offset'] = offset * 1000
+
+        if abs(offset) > args.max_offset / 1000:
+            raise IOError('off by %.1f ms after setting' % (offset * 1000))
+        if args.brightness is not None and results[1][0] != args.brightness:
+            raise IOError('brightness reads back as %u' % results[1][0])
+        if args.version and report['version'] != args.version:
+            raise IOError('version %s, expected %s' % (report['version'],
+                                                       args.version))
+        report['ok'] = True
+    except (IOError, UnicodeDecodeError) as e:
+        report['error'] = str(e)
+    report['ms'] = (time.monotonic() - start) * 1000
+    return report
+
+def fleet(args):
+    """Provision all clocks found at once, and report per port."""
+    # Ports given without wildcards are kept even when missing, to report.
+    ports = sorted(set(p for pattern in args.ports or FLEET_PORTS
+                       for p in glob.glob(pattern) or
+                       ([] if glob.has_magic(pattern) else [pattern])))
+    if not ports:
+        raise SystemExit('No ports found')
+
+    start = time.monotonic()
+    with concurrent.futures.ThreadPoolExecutor(len(ports)) as pool:
+        reports = list(pool.map(lambda p: provision(p, args), ports))
+    total = (time.monotonic() - start) * 1000
+
+    print('%-20s %-6s %8s %10s  %-16s %s' % ('port', 'result', 'ms',
+                                             'offset ms', 'version', 'error'))
+    for r in reports:
+        offset = '%+.1f' % r['offset'] if r['offset'] is not None else ''
+        print('%-20s %-6s %8.1f %10s  %-16s %s' % (r['port'],
+              'ok' if r['ok'] else 'FAIL', r['ms'], offset, r['version'],
+              r['error']))
+    failed = sum(not r['ok'] for r in reports)
+    print('%d clocks, %d failed, %.1f ms' % (len(reports), failed, total))
+    return 1 if failed else 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Control SimpleClock via UART')
+    parser.add_argument('-p', '--port', default=DEFAULT_PORT)
+    parser.add_argument('-b', '--baud', type=int, default=DEFAULT_BAUD,
+                        help='Baud rate to switch to for the command (the '
+                             'clock starts at %d)' % DEFAULT_BAUD)
+    parser.add_argument('-t', '--text', action='store_true',
+                        help='Use the text commands instead of binary frames')
+    parser.add_argument('--timeout', type=float, default=1,
+                        help='Seconds to wait for a response')
+    subparsers = parser.add_subparsers(help='Command', dest='command')
+    subparsers.required = True
+    add_commands(subparsers)
+    subparsers.add_parser('batch', help='Run the commands in a file (- for '
+                          'stdin), one per line, in a single session'
+                          ).add_argument('file', type=argparse.FileType('r'))
+    fleet_parser = subparsers.add_parser('fleet', help='Set the time and date '
+                                         'of all clocks found at once (--port '
+                                         'is ignored)')
+    fleet_parser.add_argument('ports', nargs='*',
+                              help='Ports or glob patterns (default: %s)' %
+                                   ' '.join(FLEET_PORTS))
+    fleet_parser.add_argument('--brightness', type=int, choices=range(8),
+                              help='Also set the brightness')
+    fleet_parser.add_argument('--save', action='store_true',
+                              help='Save the settings to EEPROM')
+    fleet_parser.add_argument('--version',
+                              help='Fail clocks with another firmware version')
+    fleet_parser.add_argument('--max-offset', type=float, default=100,
+                              help='Fail clocks further off than this (ms) '
+                                   'after setting them (default: %(default)s)')
+
+    calibrate_parser = subparsers.add_parser(
+            'calibrate', help='Measure the drift of the clock against the '
+            'host clock (which should be kept by NTP) and correct its aging '
+            'offset for it')
+    calibrate_parser.add_argument('--duration', type=float, default=3600,
+                                  help='Seconds to measure (default: '
+                                       '%(default)s)')
+    calibrate_parser.add_argument('--interval', type=float, default=30,
+                                  help='Seconds between samples, which keep '
+                                       'the clock awake (default: '
+                                       '%(default)s, at most 50)')
+    calibrate_parser.add_argument('--dry-run', action='store_true',
+                                  help='Do not write the aging offset')
+
+    args = parser.parse_args()
+
+    if args.command == 'calibrate':
+        if args.text:
+            parser.error('calibrate only works with binary frames')
+        if not 0 < args.interval <= 50:
+            parser.error('the clock powers down when idle for a minute')
+        with Clock(args.port, args.baud, args.timeout) as clock:
+            calibrate(clock, args.duration, args.interval, args.dry_run)
+        return
+    if args.command == 'fleet':
+        if args.text:
+            parser.error('fleet only works with binary frames')
+        sys.exit(fleet(args))
 
-    cmd = cmds[args.command].encode('utf-8')
+    if args.command == 'batch':
+        batch_parser = argparse.ArgumentParser(prog='batch', add_help=False)
+        batch_subparsers = batch_parser.add_subparsers(dest='command')
+        batch_subparsers.required = True
+        add_commands(batch_subparsers)
+        batch = read_batch(batch_parser, args.file)
+        prefix = lambda a: a.command + ': '
+    else:
+        batch = [args]
+        prefix = lambda a: ''
 
-    communicate(cmd, args.port, args.baud)
+    with Clock(args.port, args.baud, args.timeout, args.text) as clock:
+        run(clock, batch, prefix)
 
 
 if __name__ == '__main__':
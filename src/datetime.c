@@ -1,3 +1,5 @@
+#include <avr/pgmspace.h>
+
 #include "datetime.h"
 #include "uart.h"
 
@@ -49,10 +51,21 @@ u8 date_year_is_leap(u16 year)
 {
     return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
 }
+
+static const u8 month_days[] PROGMEM =
+{
+    31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+};
+
+/* Days in the year before the first of each month (non-leap year). */
+static const u16 month_start[] PROGMEM =
+{
+    0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+};
+
 u8 date_days_per_month(u8 month, u16 year)
 {
-    u8 month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    u8 days = month_days[month - 1];
+    u8 days = pgm_read_byte(&month_days[month - 1]);
     if (month == 2 && date_year_is_leap(year))
         days++;
     return days;
@@ -69,25 +82,70 @@ void date_next(struct date *date)
         }
     }
 }
-u16 date_diff_days(struct date *date1, struct date *date2)
-{
-    struct date iter, target;
-    u16 days = 0;
 
-    if (date_cmp(date1, date2) < 0) {
-        iter = *date1;
-        target = *date2;
-    } else {
-        iter = *date2;
-        target = *date1;
-    }
+/*
+ * Day numbers count days since 1-1-1900, the start of the range supported by
+ * the RTC (1900..2099). Within that range 1900 is the only century year, and
+ * it is not a leap year.
+ */
+
+/* Day number of 1-1 of the given year (relative to 1900). */
+static u32 year_start(u8 y)
+{
+    return 365UL * y + (y + 3) / 4 - (y > 0);
+}
 
-    while (date_cmp(&iter, &target)) {
-        date_next(&iter);
-        //LOGF("%d - %02u-%02u-%02u", days, iter.day, iter.month, iter.year);
+u32 date_to_days(struct date *date)
+{
+    u32 days = year_start(date->year - 1900);
+    days += pgm_read_word(&month_start[date->month - 1]);
+    if (date->month > 2 && date_year_is_leap(date->year))
         days++;
+    return days + date->day - 1;
+}
+
+void date_from_days(u32 days, struct date *ret)
+{
+    u8 y = days / 365;
+    u16 yday;
+    u8 month, mdays;
+
+    /* The estimate is at most one year too late. */
+    if (year_start(y) > days)
+        y--;
+
+    ret->year = 1900 + y;
+    yday = days - year_start(y);
+    for (month = 1; ; month++) {
+        mdays = date_days_per_month(month, ret->year);
+        if (yday < mdays)
+            break;
+        yday -= mdays;
     }
-    return days;
+    ret->month = month;
+    ret->day = yday + 1;
+}
+
+/* ISO weekday: 1 = Monday .. 7 = Sunday. */
+u8 date_weekday(struct date *date)
+{
+    return date_to_days(date) % 7 + 1; /* 1-1-1900 was a Monday */
+}
+
+void date_add_days(struct date *date, s32 days)
+{
+    date_from_days(date_to_days(date) + days, date);
+}
+
+/* Differences beyond 65535 days wrap around. */
+u16 date_diff_days(struct date *date1, struct date *date2)
+{
+    u32 days1 = date_to_days(date1);
+    u32 days2 = date_to_days(date2);
+
+    if (days1 < days2)
+        return days2 - days1;
+    return days1 - days2;
 }
 
 void datetime_print(struct datetime *datetime)
@@ -12,6 +12,10 @@ u8 date_year_is_leap(u16 year);
 u8 date_days_per_month(u8 month, u16 year);
 void date_next(struct date *date);
 
+u32 date_to_days(struct date *date);
+void date_from_days(u32 days, struct date *ret);
+u8 date_weekday(struct date *date);
+void date_add_days(struct date *date, s32 days);
 u16 date_diff_days(struct date *date1, struct date *date2);
 
 void datetime_print(struct datetime *datetime);
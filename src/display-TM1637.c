@@ -4,19 +4,88 @@
  * The TM1637 talks a variant of the I2C/TWI protocol, that among other things
  * does not use the address at the start of transactions. As such, we implement
  * this protocol in software on separate pins from other I2C devices.
+ *
+ * Frames are clocked out in the background from Timer1 compare interrupts, so
+ * display_setsegs() returns immediately. Between frames of scrolling text the
+ * same timer runs at a low rate to move the text along.
  */
 
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 
 #include "uart.h"
+#include "uart-baud.h"
 #include "display.h"
 #include "pins.h"
+#include "stack.h"
+#include "isrstats.h"
+
+/*
+ * Bit timing. A frame is sent as a sequence of steps, each a single pin change.
+ * Every DISP_TICK_US a Timer1 interrupt performs DISP_STEPS_PER_TICK of them,
+ * DISP_EDGE_US apart.
+ *
+ * The standard profile is the original timing of 100us between all edges. The
+ * fast profile (DISP_FAST=1) sends up to a byte and its ACK (28 steps) per
+ * interrupt, with edges only as far apart as the TM1637 needs (clock pulses of
+ * at least 400ns). As the interrupt runs with interrupts disabled, it takes at
+ * most half a byte time at the fastest baud rate, leaving the rest for the
+ * LIN/UART to fetch a received byte before the next one overruns it. The
+ * interrupt rate is then limited by the CPU: the tick is derived from F_CPU so
+ * that a quarter of the CPU is left for everything else.
+ */
+#ifndef DISP_FAST
+# define DISP_FAST 0
+#endif
+
+#if DISP_FAST
+# define DISP_EDGE_US 1
+# define DISP_STEP_CYCLES (12 + DISP_EDGE_US * (F_CPU / 1000000UL))
+# define DISP_UART_STEPS (F_CPU * 10 / UART_BAUD_FASTEST / 2 / DISP_STEP_CYCLES)
+# define DISP_STEPS_PER_TICK (DISP_UART_STEPS < 28 ? DISP_UART_STEPS : 28)
+# if DISP_STEPS_PER_TICK < 1
+#  error "Fastest baud rate leaves no time for a display step"
+# endif
+# define DISP_TICK_US \
+    (DISP_STEPS_PER_TICK * DISP_STEP_CYCLES * 4 / 3 / (F_CPU / 1000000UL) + 1)
+#else
+# define DISP_EDGE_US 0
+# define DISP_STEPS_PER_TICK 1
+# define DISP_TICK_US 100
+#endif
 
-#define BIT_DELAY 100 /* us */
+#define TIMER_TOP ((F_CPU / 1000000UL) * DISP_TICK_US - 1)
+#if TIMER_TOP > 0xffff
+# error "DISP_TICK_US too long for Timer1"
+#endif
 
-#define COMM1 0x40
-#define COMM2 0xc0
-#define COMM3 0x80
+/* Time each position of scrolling text is shown. */
+#ifndef DISPLAY_SCROLL_MS
+# define DISPLAY_SCROLL_MS 300
+#endif
+
+#define SCROLL_TOP ((F_CPU / 1024) * DISPLAY_SCROLL_MS / 1000 - 1)
+#if SCROLL_TOP > 0xffff
+# error "DISPLAY_SCROLL_MS too long for Timer1"
+#endif
+
+/* Frames that are not ACKed are resent up to this many times. */
+#define DISP_ACK_RETRIES 3
+
+/* Hook for the host build to record every CLK/DIO change. */
+#ifndef DISP_TRACE
+# define DISP_TRACE() do { } while (0)
+#endif
+
+#define COMM1 0x40 /* Data command, auto-increment address */
+#define COMM1_FIXED 0x44 /* Data command, fixed address */
+#define COMM2 0xc0 /* Address command */
+#define COMM3 0x80 /* Display control command */
 
 #define DISP_ON 0x08
 
@@ -35,25 +104,34 @@
  * (:) in the middle the dot is not available, and enabling the dot on the 2nd
  * digit turns on the colon.
  */
-static const u8 segment_lut[] PROGMEM =
-{
-                  // P G F E D C B A
-    [0x0] = 0x3f, // 0 0 1 1 1 1 1 1
-    [0x1] = 0x06, // 0 0 0 0 0 1 1 0
-    [0x2] = 0x5b, // 0 1 0 1 1 0 1 1
-    [0x3] = 0x4f, // 0 1 0 0 1 1 1 1
-    [0x4] = 0x66, // 0 1 1 0 0 1 1 0
-    [0x5] = 0x6d, // 0 1 1 0 1 1 0 1
-    [0x6] = 0x7d, // 0 1 1 1 1 1 0 1
-    [0x7] = 0x07, // 0 0 0 0 0 1 1 1
-    [0x8] = 0x7f, // 0 1 1 1 1 1 1 1
-    [0x9] = 0x6f, // 0 1 1 0 1 1 1 1
-    [0xa] = 0x77, // 0 1 1 1 0 1 1 1
-    [0xb] = 0x7c, // 0 1 1 1 1 1 0 0
-    [0xc] = 0x39, // 0 0 1 1 1 0 0 1
-    [0xd] = 0x5e, // 0 1 0 1 1 1 1 0
-    [0xe] = 0x79, // 0 1 1 1 1 0 0 1
-    [0xf] = 0x71, // 0 1 1 1 0 0 0 1
+static const u8 font[] PROGMEM =
+{
+    /* Printable ASCII from ' ' on. Some letters (K, M, V, W, X) are only an
+     * approximation, and '*' is a degree sign for temperatures. */
+    /*  ' '   !     "     #     $     %     &     '  */
+        0x00, 0x86, 0x22, 0x7e, 0x6d, 0xd2, 0x46, 0x20,
+    /*  (     )     *     +     ,     -     .     /  */
+        0x29, 0x0b, 0x63, 0x70, 0x10, 0x40, 0x80, 0x52,
+    /*  0     1     2     3     4     5     6     7  */
+        0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07,
+    /*  8     9     :     ;     <     =     >     ?  */
+        0x7f, 0x6f, 0x09, 0x0d, 0x61, 0x48, 0x43, 0xd3,
+    /*  @     A     B     C     D     E     F     G  */
+        0x5f, 0x77, 0x7c, 0x39, 0x5e, 0x79, 0x71, 0x3d,
+    /*  H     I     J     K     L     M     N     O  */
+        0x76, 0x30, 0x1e, 0x75, 0x38, 0x15, 0x37, 0x3f,
+    /*  P     Q     R     S     T     U     V     W  */
+        0x73, 0x6b, 0x33, 0x6d, 0x78, 0x3e, 0x3e, 0x2a,
+    /*  X     Y     Z     [     \     ]     ^     _  */
+        0x76, 0x6e, 0x5b, 0x39, 0x64, 0x0f, 0x23, 0x08,
+    /*  `     a     b     c     d     e     f     g  */
+        0x02, 0x5f, 0x7c, 0x58, 0x5e, 0x7b, 0x71, 0x6f,
+    /*  h     i     j     k     l     m     n     o  */
+        0x74, 0x10, 0x0c, 0x75, 0x30, 0x14, 0x54, 0x5c,
+    /*  p     q     r     s     t     u     v     w  */
+        0x73, 0x67, 0x50, 0x6d, 0x78, 0x1c, 0x1c, 0x14,
+    /*  x     y     z     {     |     }     ~        */
+        0x76, 0x6e, 0x5b, 0x46, 0x30, 0x70, 0x01, 0x00,
 };
 
 static const u8 startup_state[] PROGMEM =
@@ -65,6 +143,58 @@ static const u8 startup_state[] PROGMEM =
     0x00, //    0 0 0 0 0 0 0 0
 };
 
+/*
+ * What the display shows once the frame being sent (if any) is done, and what
+ * it should show. Whenever a frame completes, the next one is built from the
+ * difference between the two, so newer updates replace ones not yet sent.
+ */
+static u8 shown_segs[DISPLAY_NUM_DIGITS];
+static bool shown_valid;
+static u8 shown_ctrl;
+static u8 data_mode; /* The TM1637 keeps this until it gets a new one */
+static u8 want_segs[DISPLAY_NUM_DIGITS];
+static u8 want_ctrl;
+
+/*
+ * Text wider than the display, followed by a blank, as a ring that the
+ * display is a window on. text_len is 0 when not scrolling.
+ */
+static u8 text_segs[DISPLAY_TEXT_MAX + 1];
+static u8 text_len;
+static u8 text_pos;
+
+/*
+ * The frame being sent: a sequence of commands, each stored as its length
+ * followed by its bytes, terminated by a zero length. Worst case is a mode
+ * switch, four fixed-address commands and a control command.
+ */
+#define FRAME_MAX (2 + 4 * 3 + 2 + 1)
+static u8 frame[FRAME_MAX];
+
+/* Each step is one pin action. */
+enum step {
+    S_IDLE,
+    S_START,        /* DIO low */
+    S_BIT_CLK_LOW,
+    S_BIT_DATA,
+    S_BIT_CLK_HIGH,
+    S_ACK_CLK_LOW,  /* CLK low, release DIO */
+    S_ACK_CLK_HIGH,
+    S_ACK_READ,     /* Device pulls DIO low to ACK */
+    S_ACK_END,      /* CLK low */
+    S_END_DIO_LOW,
+    S_END_CLK_HIGH,
+    S_END_DIO_HIGH,
+};
+
+static volatile u8 step = S_IDLE;
+static const u8 *cmd;   /* Next byte of the current command */
+static u8 cmd_left;     /* Bytes left in the current command */
+static u8 cur_byte;
+static u8 cur_bit;
+static bool frame_nak;  /* Some byte of the current frame was not ACKed */
+static u8 retries;
+
 void display_init(void)
 {
     u8 segs[sizeof(startup_state)];
@@ -74,79 +204,370 @@ void display_init(void)
     pin_write(PIN_DISP_CLK, 0);
     pin_write(PIN_DISP_DIO, 0);
 
+    /* Timer1 in CTC mode, only running (and powered) while sending */
+    power_timer1_enable();
+    TCCR1A = 0;
+    TCCR1B = 1<<WGM12;
+    OCR1A = TIMER_TOP;
+    power_timer1_disable();
+
     memcpy_P(segs, startup_state, sizeof(startup_state));
     display_setsegs(segs, 1);
 }
 
-static void disp_delay(void)
+/*
+ * Build the frame that takes the display from shown to want. Returns false if
+ * there is nothing to send.
+ */
+static bool build_frame(void)
 {
-    _delay_us(BIT_DELAY);
+    u8 *p = frame;
+    u8 first = DISPLAY_NUM_DIGITS, last = 0, changed = 0;
+    u8 cost_auto, cost_fixed, mode;
+
+    for (u8 i = 0; i < DISPLAY_NUM_DIGITS; i++) {
+        if (shown_valid && want_segs[i] == shown_segs[i])
+            continue;
+        if (first == DISPLAY_NUM_DIGITS)
+            first = i;
+        last = i;
+        changed++;
+    }
+
+    if (changed) {
+        /*
+         * A command costs about as much as a byte. Either send the range of
+         * digits spanning all changes in a single auto-increment command, or
+         * a fixed-address command per changed digit, whichever is cheaper
+         * (including switching address mode).
+         */
+        cost_auto = last - first + 2 + (data_mode != COMM1 ? 2 : 0);
+        cost_fixed = 3 * changed + (data_mode != COMM1_FIXED ? 2 : 0);
+        mode = cost_fixed < cost_auto ? COMM1_FIXED : COMM1;
+
+        if (data_mode != mode) {
+            *p++ = 1;
+            *p++ = mode;
+            data_mode = mode;
+        }
+        if (mode == COMM1_FIXED) {
+            for (u8 i = first; i <= last; i++) {
+                if (shown_valid && want_segs[i] == shown_segs[i])
+                    continue;
+                *p++ = 2;
+                *p++ = COMM2 | i;
+                *p++ = want_segs[i];
+            }
+        } else {
+            *p++ = last - first + 2;
+            *p++ = COMM2 | first;
+            for (u8 i = first; i <= last; i++)
+                *p++ = want_segs[i];
+        }
+
+        memcpy(shown_segs, want_segs, DISPLAY_NUM_DIGITS);
+        shown_valid = true;
+    }
+
+    if (want_ctrl != shown_ctrl) {
+        *p++ = 1;
+        *p++ = want_ctrl;
+        shown_ctrl = want_ctrl;
+    }
+
+    *p = 0;
+    return p != frame;
 }
-static void start_command(void)
+
+static void next_command(void)
 {
-    pin_set_mode(PIN_DISP_DIO, OUTPUT);
-    disp_delay();
+    cmd_left = *cmd++;
+    step = cmd_left ? S_START : S_IDLE;
 }
-static void end_command(void)
+
+static void next_byte(void)
 {
-    pin_set_mode(PIN_DISP_DIO, OUTPUT);
-    disp_delay();
-    pin_set_mode(PIN_DISP_CLK, INPUT);
-    disp_delay();
-    pin_set_mode(PIN_DISP_DIO, INPUT);
-    disp_delay();
+    cur_byte = *cmd++;
+    cmd_left--;
+    cur_bit = 0;
+    step = S_BIT_CLK_LOW;
 }
-static void write_byte(u8 val)
+
+/*
+ * The lines are open-drain: pull them low by making the pin an output (PORT is
+ * 0), and release them to let the pull-ups make them high.
+ */
+#define line_low(pin) \
+    do { \
+        pin_set_mode(pin, OUTPUT); \
+        DISP_TRACE(); \
+    } while (0)
+#define line_release(pin) \
+    do { \
+        pin_set_mode(pin, INPUT); \
+        DISP_TRACE(); \
+    } while (0)
+
+/*
+ * Called when the last command of a frame has been sent. A frame that was not
+ * fully ACKed is sent again, as all its commands can safely be repeated. When
+ * that keeps failing we give up and forget what the display shows, so the next
+ * update rewrites all of it.
+ */
+static void frame_done(void)
 {
-    u8 ack;
+    if (frame_nak) {
+        frame_nak = false;
+        if (retries < DISP_ACK_RETRIES) {
+            retries++;
+            cmd = frame;
+            next_command();
+            return;
+        }
+        LOG("ERROR: No ACK from TM1637");
+        retries = 0;
+        shown_valid = false;
+        shown_ctrl = 0;
+        data_mode = 0;
+        return;
+    }
 
-    for (u8 i = 0; i < 8; i++) {
-        pin_set_mode(PIN_DISP_CLK, OUTPUT);
-        disp_delay();
+    retries = 0;
+    if (build_frame()) {
+        cmd = frame;
+        next_command();
+    }
+}
 
-        if (val & (1 << i))
-            pin_set_mode(PIN_DISP_DIO, INPUT);
+static inline void do_step(void)
+{
+    switch (step) {
+    case S_START:
+        line_low(PIN_DISP_DIO);
+        next_byte();
+        break;
+
+    case S_BIT_CLK_LOW:
+        line_low(PIN_DISP_CLK);
+        step = S_BIT_DATA;
+        break;
+    case S_BIT_DATA:
+        if (cur_byte & (1 << cur_bit))
+            line_release(PIN_DISP_DIO);
+        else
+            line_low(PIN_DISP_DIO);
+        step = S_BIT_CLK_HIGH;
+        break;
+    case S_BIT_CLK_HIGH:
+        line_release(PIN_DISP_CLK);
+        step = ++cur_bit < 8 ? S_BIT_CLK_LOW : S_ACK_CLK_LOW;
+        break;
+
+    case S_ACK_CLK_LOW:
+        line_low(PIN_DISP_CLK);
+        line_release(PIN_DISP_DIO);
+        step = S_ACK_CLK_HIGH;
+        break;
+    case S_ACK_CLK_HIGH:
+        line_release(PIN_DISP_CLK);
+        step = S_ACK_READ;
+        break;
+    case S_ACK_READ:
+        if (pin_read(PIN_DISP_DIO) == 0)
+            line_low(PIN_DISP_DIO);
+        else
+            frame_nak = true;
+        step = S_ACK_END;
+        break;
+    case S_ACK_END:
+        line_low(PIN_DISP_CLK);
+        if (cmd_left)
+            next_byte();
         else
-            pin_set_mode(PIN_DISP_DIO, OUTPUT);
-        disp_delay();
+            step = S_END_DIO_LOW;
+        break;
 
-        pin_set_mode(PIN_DISP_CLK, INPUT);
-        disp_delay();
+    case S_END_DIO_LOW:
+        line_low(PIN_DISP_DIO);
+        step = S_END_CLK_HIGH;
+        break;
+    case S_END_CLK_HIGH:
+        line_release(PIN_DISP_CLK);
+        step = S_END_DIO_HIGH;
+        break;
+    case S_END_DIO_HIGH:
+        line_release(PIN_DISP_DIO);
+        next_command();
+        if (step == S_IDLE)
+            frame_done();
+        break;
     }
+}
 
-    pin_set_mode(PIN_DISP_CLK, OUTPUT);
-    pin_set_mode(PIN_DISP_DIO, INPUT);
-    disp_delay();
+/* Run Timer1 at the bit rate, for the frame that was just set up. */
+static void start_frame(void)
+{
+    power_timer1_enable();
+    TCCR1B = 1<<WGM12;
+    OCR1A = TIMER_TOP;
+    TCNT1 = TIMER_TOP - 1; /* First step right away */
+    TIFR1 = 1<<OCF1A;
+    TIMSK1 = 1<<OCIE1A;
+    TCCR1B = 1<<WGM12 | 1<<CS10; /* clk/1 */
+}
 
-    pin_set_mode(PIN_DISP_CLK, INPUT);
-    disp_delay();
+/*
+ * No frame to send: wait for the next scroll position if there is scrolling
+ * text, otherwise stop Timer1.
+ */
+static void timer_idle(void)
+{
+    TCCR1B = 1<<WGM12;
+    if (text_len) {
+        OCR1A = SCROLL_TOP;
+        TCNT1 = 0;
+        TIFR1 = 1<<OCF1A;
+        TCCR1B = 1<<WGM12 | 1<<CS12 | 1<<CS10; /* clk/1024 */
+    } else {
+        TIMSK1 = 0;
+        power_timer1_disable();
+    }
+}
 
-    ack = pin_read(PIN_DISP_DIO);
-    if (ack == 0)
-        pin_set_mode(PIN_DISP_DIO, OUTPUT);
-    else
-        LOG("ERROR: No ACK from TM1637");
-    disp_delay();
+/* Send what changed since the last frame, if not busy sending already. */
+static void start_update(void)
+{
+    if (step != S_IDLE)
+        return;
+    if (build_frame()) {
+        cmd = frame;
+        next_command();
+        start_frame();
+    } else {
+        timer_idle();
+    }
+}
 
-    pin_set_mode(PIN_DISP_CLK, OUTPUT);
-    disp_delay();
+/* Put the current position of the scrolling text up, and move on. */
+static void show_window(void)
+{
+    for (u8 i = 0; i < DISPLAY_NUM_DIGITS; i++)
+        want_segs[i] = text_segs[(u8)(text_pos + i) % text_len];
+    if (++text_pos == text_len)
+        text_pos = 0;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+    u8 n = DISP_STEPS_PER_TICK;
+    ISRSTATS_ENTER();
+
+    STACK_ISR(STACK_ISR_TIMER1);
+
+    if (step == S_IDLE) {
+        /* Scroll timer */
+        show_window();
+        start_update();
+    } else {
+        for (;;) {
+            do_step();
+            if (step == S_IDLE) {
+                timer_idle();
+                break;
+            }
+            if (!--n)
+                break;
+#if DISP_EDGE_US
+            _delay_us(DISP_EDGE_US);
+#endif
+        }
+    }
+    ISRSTATS_EXIT(STACK_ISR_TIMER1);
 }
 
+/*
+ * Queue new display contents. If a frame is still being sent, the update is
+ * sent right after it, replacing any update that was waiting. This stops any
+ * scrolling text.
+ */
 void display_setsegs(u8 segs[DISPLAY_NUM_DIGITS], u8 brightness)
 {
-    start_command();
-    write_byte(COMM1);
-    end_command();
+    u8 sreg = SREG;
 
-    start_command();
-    write_byte(COMM2 | 0);
-    for (u8 i = 0; i < DISPLAY_NUM_DIGITS; i++)
-        write_byte(segs[i]);
-    end_command();
+    cli();
+    memcpy(want_segs, segs, DISPLAY_NUM_DIGITS);
+    want_ctrl = COMM3 | (brightness & 0x7) | DISP_ON;
+    text_len = 0;
+    start_update();
+    SREG = sreg;
+}
 
-    start_command();
-    write_byte(COMM3 | (brightness & 0x7) | DISP_ON);
-    end_command();
+/* Segments for an ASCII character, blank for ones the font does not have. */
+u8 display_char(char c)
+{
+    u8 i = (u8)c - ' ';
+
+    return i < sizeof(font) ? pgm_read_byte(&font[i]) : 0;
+}
+
+/*
+ * Show text, up to DISPLAY_TEXT_MAX characters. A '.' goes on the dot of the
+ * character before it where possible. Text wider than the display scrolls
+ * through it until the next update. Only the digits that change are sent.
+ */
+void display_showtext(const char *text, u8 brightness)
+{
+    u8 segs[DISPLAY_TEXT_MAX + 1];
+    u8 len = 0;
+    u8 sreg;
+
+    for (; *text && len < DISPLAY_TEXT_MAX; text++) {
+        if (*text == '.' && len && !(segs[len - 1] & 0x80))
+            segs[len - 1] |= 0x80;
+        else
+            segs[len++] = display_char(*text);
+    }
+
+    if (len <= DISPLAY_NUM_DIGITS) {
+        while (len < DISPLAY_NUM_DIGITS)
+            segs[len++] = 0;
+        display_setsegs(segs, brightness);
+        return;
+    }
+    segs[len++] = 0; /* Gap before the text comes round again */
+
+    sreg = SREG;
+    cli();
+    memcpy(text_segs, segs, len);
+    text_len = len;
+    text_pos = 0;
+    want_ctrl = COMM3 | (brightness & 0x7) | DISP_ON;
+    show_window();
+    start_update();
+    SREG = sreg;
+}
+
+/* Scrolling text also counts as busy, as it needs Timer1 running. */
+bool display_busy(void)
+{
+    return step != S_IDLE || text_len;
+}
+
+/* Sleep until all queued updates are on the display. */
+void display_wait(void)
+{
+    u8 sreg = SREG;
+
+    for (;;) {
+        cli();
+        if (step == S_IDLE)
+            break;
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    SREG = sreg;
 }
 
 void display_shownum(u16 num, bool colon, bool pad, u8 brightness)
@@ -158,7 +579,7 @@ void display_shownum(u16 num, bool colon, bool pad, u8 brightness)
         u8 pos = DISPLAY_NUM_DIGITS - i - 1;
         u8 digit = num % 10;
 
-        segs[pos] = pgm_read_byte(&segment_lut[digit]);
+        segs[pos] = display_char('0' + digit);
 
         if (digit > 0)
             last_nonzero = pos;
@@ -170,7 +591,7 @@ void display_shownum(u16 num, bool colon, bool pad, u8 brightness)
     }
 
     if (!pad) {
-        u8 zero_segs = pgm_read_byte(&segment_lut[0]);
+        u8 zero_segs = display_char('0');
         for (u8 i = 0; i < last_nonzero; i++)
             segs[i] &= ~zero_segs;
     }
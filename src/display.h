@@ -4,9 +4,14 @@
 #include "types.h"
 
 #define DISPLAY_NUM_DIGITS 4
+#define DISPLAY_TEXT_MAX 16
 
 void display_init(void);
 void display_setsegs(u8 segs[DISPLAY_NUM_DIGITS], u8 brightness);
 void display_shownum(u16 num, bool colon, bool pad, u8 brightness);
+void display_showtext(const char *text, u8 brightness);
+u8 display_char(char c);
+bool display_busy(void);
+void display_wait(void);
 
 #endif
@@ -0,0 +1,45 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "events.h"
+#include "power.h"
+#include "isrstats.h"
+
+static volatile u8 pending;
+
+/* Safe to call from both ISRs and the main loop. */
+void events_post(u8 ev)
+{
+    u8 sreg = SREG;
+
+    cli();
+    isrstats_posted(ev & ~pending);
+    pending |= ev;
+    SREG = sreg;
+}
+
+/* Return and clear all pending events. */
+u8 events_take(void)
+{
+    u8 ev;
+
+    cli();
+    ev = pending;
+    pending = 0;
+    isrstats_taken(ev);
+    sei();
+    return ev;
+}
+
+/*
+ * Sleep until an event is posted. Interrupts are only enabled right before
+ * going to sleep (sei takes effect after the next instruction), so an event
+ * posted after the check still wakes us up.
+ */
+void events_wait(void)
+{
+    cli();
+    if (!pending)
+        power_sleep();
+    sei();
+}
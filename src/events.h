@@ -0,0 +1,19 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "types.h"
+
+/*
+ * Work deferred from interrupt handlers to the main loop. ISRs only post
+ * events; the main loop takes them and does the actual (slow) work with
+ * interrupts enabled.
+ */
+#define EV_MINUTE   (1 << 0) /* RTC alarm fired, refresh the display */
+#define EV_UART_RX  (1 << 1) /* Received line(s) queued for uart_process() */
+#define EV_FRAME    (1 << 2) /* Binary frame received, see proto_process() */
+
+void events_post(u8 ev);
+u8 events_take(void);
+void events_wait(void);
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * Host stand-in for <avr/eeprom.h>. EEMEM variables live in RAM; every byte
+ * actually written is counted and charged the ~3.4 ms the ATtiny87 stalls for.
+ */
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+void eeprom_write_block(const void *src, void *dst, size_t n);
+void eeprom_update_byte(uint8_t *p, uint8_t value);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif
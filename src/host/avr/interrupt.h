@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for <avr/interrupt.h>. Interrupt vectors become ordinary
+ * functions (e.g. INT1_vect()) that the host harness calls directly.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void); void vector(void)
+
+#define sei() do { } while (0)
+#define cli() do { } while (0)
+
+#endif
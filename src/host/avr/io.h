@@ -0,0 +1,93 @@
+/*
+ * Host stand-in for <avr/io.h>.
+ *
+ * The I/O registers used by the portable parts of the firmware (GPIO, external
+ * and pin change interrupts, Timer1, PRR) are plain memory on the host, defined
+ * in hal.c. The LIN/UART registers are too, with uart-host.c modelling the
+ * controller behind them. The USI driver is replaced wholesale by twi-host.c.
+ */
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+extern volatile uint8_t DDRA, PORTA, PINA;
+extern volatile uint8_t DDRB, PORTB, PINB;
+extern volatile uint8_t EICRA, EIMSK, EIFR;
+extern volatile uint8_t SREG;
+
+#define SREG_I 7
+
+/* The stack pointer stays at the top of RAM: the host has no AVR stack. */
+extern volatile uint16_t SP;
+
+#define RAMSTART 0x100
+#define RAMEND 0x2ff
+
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A;
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define OCIE1A 1
+#define OCF1A 1
+
+extern volatile uint8_t CLKPR;
+
+#define CLKPCE 7
+
+extern volatile uint8_t PRR;
+
+#define PRADC 0
+#define PRUSI 1
+#define PRTIM0 2
+#define PRTIM1 3
+#define PRSPI 4
+#define PRLIN 5
+
+extern volatile uint8_t LINCR, LINSIR, LINENIR, LINERR, LINBTR;
+extern volatile uint8_t LINBRRL, LINBRRH, LINDAT;
+
+#define LCMD0 0
+#define LCMD1 1
+#define LCMD2 2
+#define LENA 3
+#define LSWRES 7
+#define LRXOK 0
+#define LTXOK 1
+#define LERR 3
+#define LBUSY 4
+#define LENRXOK 0
+#define LENTXOK 1
+#define LOVERR 5
+#define LDISR 7
+
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1;
+
+#define PCIE0 0
+#define PCIE1 1
+#define PCIF0 0
+#define PCIF1 1
+
+#define ISC10 2
+#define ISC11 3
+#define INT0 0
+#define INT1 1
+#define INTF0 0
+#define INTF1 1
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+/* Busy-waiting on a register lets the simulated hardware behind it progress. */
+void host_poll(volatile uint8_t *sfr);
+#define loop_until_bit_is_set(sfr, bit) \
+    do { host_poll(&(sfr)); } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) \
+    do { host_poll(&(sfr)); } while (bit_is_set(sfr, bit))
+
+#endif
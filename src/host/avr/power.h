@@ -0,0 +1,37 @@
+/*
+ * Host stand-in for <avr/power.h>, operating on the PRR and CLKPR in hal.c.
+ */
+
+#ifndef HOST_AVR_POWER_H
+#define HOST_AVR_POWER_H
+
+#include <avr/io.h>
+
+#define power_adc_enable() (PRR &= ~(1 << PRADC))
+#define power_adc_disable() (PRR |= 1 << PRADC)
+#define power_usi_enable() (PRR &= ~(1 << PRUSI))
+#define power_usi_disable() (PRR |= 1 << PRUSI)
+#define power_timer0_enable() (PRR &= ~(1 << PRTIM0))
+#define power_timer0_disable() (PRR |= 1 << PRTIM0)
+#define power_timer1_enable() (PRR &= ~(1 << PRTIM1))
+#define power_timer1_disable() (PRR |= 1 << PRTIM1)
+#define power_spi_enable() (PRR &= ~(1 << PRSPI))
+#define power_spi_disable() (PRR |= 1 << PRSPI)
+#define power_lin_enable() (PRR &= ~(1 << PRLIN))
+#define power_lin_disable() (PRR |= 1 << PRLIN)
+
+typedef enum {
+    clock_div_1 = 0,
+    clock_div_2 = 1,
+    clock_div_4 = 2,
+    clock_div_8 = 3,
+    clock_div_16 = 4,
+    clock_div_32 = 5,
+    clock_div_64 = 6,
+    clock_div_128 = 7,
+    clock_div_256 = 8,
+} clock_div_t;
+
+#define clock_prescale_set(x) (CLKPR = (x))
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for <avr/sleep.h>.
+ */
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+extern int host_sleep_mode;
+#define set_sleep_mode(mode) (host_sleep_mode = (mode))
+#define sleep_enable() do { } while (0)
+#define sleep_disable() do { } while (0)
+void host_sleep(void);
+
+#define sleep_cpu() host_sleep()
+#define sleep_mode() host_sleep()
+
+#endif
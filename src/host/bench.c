@@ -0,0 +1,1005 @@
+/*
+ * Microbenchmarks for the firmware hot paths, built against the host HAL.
+ *
+ * For every benchmark we report the host time per call, plus what the call
+ * costs on the clock itself in terms the host can account for exactly: time spent busy-waiting in _delay_* and on
+ * the TWI bus, time spent asleep waiting for timer-driven work, TWI bytes
+ * transferred and EEPROM bytes written.
+ *
+ * The host time is gcc -O2 code on this machine: it only compares algorithms
+ * (such as the "(ref)" rows against their replacements), it is not what the
+ * AVR spends. make bench-avr counts AVR cycles.
+ *
+ * When given a file name, the same numbers are also written there as JSON
+ * lines (one object per benchmark or power report, after a header with the
+ * version and build configuration), to compare between versions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../datetime.h"
+#include "../display.h"
+#include "../uart.h"
+#include "../twi.h"
+#include "../rtc.h"
+#include "../events.h"
+#include "../power.h"
+#include "../settings.h"
+#include "../proto.h"
+#include "../sysclk.h"
+#include "../uart-baud.h"
+#include "../isrstats.h"
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
+#include "host.h"
+#include "datetime-ref.h"
+
+/* From main.c */
+void init(void);
+void update_display(void);
+void handle_command(char *msg);
+void process_events(void);
+void INT1_vect(void);
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static FILE *json;
+
+struct bench_state {
+    const char *name;
+    unsigned long iters;
+    double start_ns;
+    double delay_us;
+    double sleep_us;
+    unsigned long twi_bytes;
+    unsigned long eeprom_writes;
+};
+
+static void bench_begin(struct bench_state *b, const char *name,
+        unsigned long iters)
+{
+    b->name = name;
+    b->iters = iters;
+    b->delay_us = host_delay_us;
+    b->sleep_us = host_sleep_us;
+    b->twi_bytes = host_twi_bytes;
+    b->eeprom_writes = host_eeprom_writes;
+    b->start_ns = now_ns();
+}
+
+static void bench_end(struct bench_state *b)
+{
+    double ns = now_ns() - b->start_ns;
+
+    printf("%-28s %9lu %12.1f %14.1f %12.1f %10.1f %10.2f\n", b->name,
+            b->iters, ns / b->iters, (host_delay_us - b->delay_us) / b->iters,
+            (host_sleep_us - b->sleep_us) / b->iters,
+            (double)(host_twi_bytes - b->twi_bytes) / b->iters,
+            (double)(host_eeprom_writes - b->eeprom_writes) / b->iters);
+    if (json)
+        fprintf(json, "{\"bench\": \"%s\", \"calls\": %lu, \"host_ns\": %.1f, "
+                "\"device_us\": %.1f, \"sleep_us\": %.1f, \"twi_bytes\": %.1f, "
+                "\"eeprom_bytes\": %.2f}\n", b->name, b->iters, ns / b->iters,
+                (host_delay_us - b->delay_us) / b->iters,
+                (host_sleep_us - b->sleep_us) / b->iters,
+                (double)(host_twi_bytes - b->twi_bytes) / b->iters,
+                (double)(host_eeprom_writes - b->eeprom_writes) / b->iters);
+}
+
+#define BENCH(name, iters, stmt) \
+    do { \
+        struct bench_state ___b; \
+        bench_begin(&___b, name, iters); \
+        for (unsigned long ___i = 0; ___i < (iters); ___i++) { \
+            stmt; \
+        } \
+        bench_end(&___b); \
+    } while (0)
+
+static void run_command(const char *cmd)
+{
+    char buf[32];
+
+    strcpy(buf, cmd);
+    handle_command(buf);
+    display_wait();
+    host_uart_clear();
+}
+
+static volatile u16 sink;
+
+#define CHECK(cond, date) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "calendar check failed: %s at %02u-%02u-%04u\n", \
+                    #cond, (date).day, (date).month, (date).year); \
+            exit(1); \
+        } \
+    } while (0)
+
+/*
+ * Walk every date from 1-1-1900 to 31-12-2099 with the reference date_next()
+ * and check the day-number functions against it.
+ */
+static void verify_calendar(void)
+{
+    struct date first = { .day = 1, .month = 1, .year = 1900 };
+    struct date last = { .day = 31, .month = 12, .year = 2099 };
+    struct date d = first, tmp;
+    u16 steps = 0;
+    u32 prev_days = 0;
+    u8 prev_wd = 0;
+    unsigned long n = 0;
+
+    for (;; ref_date_next(&d), steps++, n++) {
+        u32 days = date_to_days(&d);
+        u8 wd = date_weekday(&d);
+
+        date_from_days(days, &tmp);
+        CHECK(!date_cmp(&tmp, &d), d);
+        CHECK(n == 0 || days == prev_days + 1, d);
+        CHECK(n == 0 || wd == prev_wd % 7 + 1, d);
+        CHECK(date_diff_days(&first, &d) == steps, d);
+        CHECK(date_diff_days(&d, &first) == steps, d);
+        tmp = first;
+        date_add_days(&tmp, days);
+        CHECK(!date_cmp(&tmp, &d), d);
+
+        /* Full reference comparison for a sample of date pairs. */
+        if (n % 97 == 0) {
+            struct date other;
+            date_from_days((n * 7919) % 73049, &other);
+            CHECK(date_diff_days(&d, &other) == ref_date_diff_days(&d, &other),
+                  d);
+        }
+
+        prev_days = days;
+        prev_wd = wd;
+        if (!date_cmp(&d, &last))
+            break;
+    }
+    tmp = (struct date){ .day = 1, .month = 1, .year = 2000 };
+    CHECK(date_weekday(&tmp) == 6, tmp);
+    printf("calendar: %lu dates verified against reference\n\n", n + 1);
+}
+
+static void check_display_segs(const u8 *want, const char *what)
+{
+    if (memcmp(host_tm1637.segs, want, DISPLAY_NUM_DIGITS)) {
+        fprintf(stderr, "display check failed: %s shows %02x %02x %02x %02x\n",
+                what, host_tm1637.segs[0], host_tm1637.segs[1],
+                host_tm1637.segs[2], host_tm1637.segs[3]);
+        exit(1);
+    }
+}
+
+/*
+ * Text that fits is shown as is. Longer text scrolls a character per wakeup
+ * of the scroll timer, sending nothing when the window did not change, until
+ * the next update stops it.
+ */
+static void verify_display_text(u8 brightness)
+{
+    static const char text[] = "-----12.5*C";
+    u8 ring[DISPLAY_TEXT_MAX + 1], want[DISPLAY_NUM_DIGITS];
+    u8 len = 0;
+
+    display_showtext("SYNC", brightness);
+    display_wait();
+    for (u8 i = 0; i < DISPLAY_NUM_DIGITS; i++)
+        want[i] = display_char("SYNC"[i]);
+    check_display_segs(want, "SYNC");
+    if (display_busy() || TIMSK1) {
+        fprintf(stderr, "display check failed: short text scrolls\n");
+        exit(1);
+    }
+
+    for (const char *c = text; *c; c++) {
+        if (*c == '.')
+            ring[len - 1] |= 0x80;
+        else
+            ring[len++] = display_char(*c);
+    }
+    ring[len++] = 0;
+
+    display_showtext(text, brightness);
+    display_wait();
+    for (u8 pos = 0; pos < 2 * len; pos++) {
+        unsigned long bytes = host_tm1637.bytes;
+        bool same = true;
+
+        for (u8 i = 0; i < DISPLAY_NUM_DIGITS; i++) {
+            u8 seg = ring[(pos + i) % len];
+
+            same &= !pos || seg == want[i];
+            want[i] = seg;
+        }
+        if (pos) {
+            sleep_cpu(); /* Scroll timer */
+            display_wait();
+        }
+        check_display_segs(want, text);
+        if (!display_busy() || (pos && same != (host_tm1637.bytes == bytes))) {
+            fprintf(stderr, "display check failed: scrolling at %u\n", pos);
+            exit(1);
+        }
+    }
+
+    display_shownum(1234, true, true, brightness);
+    display_wait();
+    if (display_busy() || TIMSK1 || host_tm1637.segs[0] != display_char('1')) {
+        fprintf(stderr, "display check failed: scrolling not stopped\n");
+        exit(1);
+    }
+}
+
+/*
+ * Drive the display through a series of updates, with and without waiting for
+ * them to be sent, and check the TM1637 model ends up showing the last one.
+ * The model checks every edge against the protocol and timing as it goes.
+ */
+static void verify_display(void)
+{
+    static const u8 digits[] = {0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07,
+                                0x7f, 0x6f};
+    u16 num = 0;
+    u8 brightness = 0;
+
+    for (unsigned i = 0; i < 5000; i++) {
+        num = (num * 37 + i) % 10000;
+        brightness = (i / 7) % 8;
+        display_shownum(num, true, true, brightness);
+        if (i % 3)
+            continue;
+
+        display_wait();
+        for (u8 pos = 0; pos < DISPLAY_NUM_DIGITS; pos++) {
+            u16 div = pos == 0 ? 1000 : pos == 1 ? 100 : pos == 2 ? 10 : 1;
+            u8 want = digits[num / div % 10] | (pos >= 2 ? 0x80 : 0);
+
+            if (host_tm1637.segs[pos] != want) {
+                fprintf(stderr, "display check failed: digit %u shows %02x "
+                        "instead of %02x for %u\n", pos, host_tm1637.segs[pos],
+                        want, num);
+                exit(1);
+            }
+        }
+        if (host_tm1637.ctrl != (0x88 | brightness)) {
+            fprintf(stderr, "display check failed: control %02x\n",
+                    host_tm1637.ctrl);
+            exit(1);
+        }
+    }
+
+    /*
+     * A byte that is not ACKed makes the driver send the frame again. When
+     * the display never ACKs, it gives up and rewrites everything once it is
+     * back, even digits it had sent before.
+     */
+    host_uart_clear();
+    host_tm1637.nack = 1;
+    display_shownum(4321, true, true, brightness);
+    display_wait();
+    if (host_tm1637.segs[0] != digits[4] || strstr(host_uart_output(), "ACK")) {
+        fprintf(stderr, "display check failed: NACKed frame not resent\n");
+        exit(1);
+    }
+    host_tm1637.nack = 255;
+    display_shownum(4322, true, true, brightness);
+    display_wait();
+    if (!strstr(host_uart_output(), "No ACK")) {
+        fprintf(stderr, "display check failed: missing ACK not reported\n");
+        exit(1);
+    }
+    host_tm1637.nack = 0;
+    memset(host_tm1637.segs, 0, sizeof(host_tm1637.segs));
+    display_shownum(4322, true, true, brightness);
+    display_wait();
+    if (host_tm1637.segs[0] != digits[4] || host_tm1637.segs[3] != (digits[2] | 0x80)) {
+        fprintf(stderr, "display check failed: not rewritten after NACKs\n");
+        exit(1);
+    }
+    host_uart_clear();
+
+    verify_display_text(brightness);
+
+    if (host_tm1637.errors) {
+        fprintf(stderr, "display check failed: %lu protocol errors\n",
+                host_tm1637.errors);
+        exit(1);
+    }
+    printf("display: %lu commands (%lu bytes) verified, min CLK pulse %.1f us, "
+            "setup %.1f us, hold %.1f us\n\n", host_tm1637.commands,
+            host_tm1637.bytes, host_tm1637.min_clk_pulse_us,
+            host_tm1637.min_setup_us, host_tm1637.min_hold_us);
+}
+
+/*
+ * Save a long series of settings through the journal, wrapping around it many
+ * times, and check each one is what settings_load() finds afterwards. Saving
+ * settings that did not change in the end must not write anything.
+ */
+static void verify_settings(void)
+{
+    struct settings orig = settings, want;
+    struct settings_stats st, prev;
+    unsigned long eep;
+
+    settings_get_stats(&prev);
+    for (unsigned i = 0; i < 20 * SETTINGS_SLOTS; i++) {
+        settings.display_brightness = i % 8;
+        settings.datediff_enabled = i % 2;
+        settings.datediff_target.time.min = i % 60;
+        settings.datediff_target.date.year = 1900 + i % 200;
+        want = settings;
+        settings_changed();
+        settings_flush();
+
+        memset(&settings, 0, sizeof(settings));
+        settings_load();
+        settings_get_stats(&st);
+        if (memcmp(&settings, &want, sizeof(want)) ||
+                st.slot != (prev.slot + 1) % SETTINGS_SLOTS ||
+                st.seq != (u8)(prev.seq + 1)) {
+            fprintf(stderr, "settings check failed: record %u, slot %u seq %u\n",
+                    i, st.slot, st.seq);
+            exit(1);
+        }
+        prev = st;
+    }
+
+    eep = host_eeprom_writes;
+    settings.display_brightness ^= 1;
+    settings_changed();
+    settings.display_brightness ^= 1;
+    settings_changed();
+    settings_flush();
+    if (host_eeprom_writes != eep) {
+        fprintf(stderr, "settings check failed: unchanged settings written\n");
+        exit(1);
+    }
+
+    settings = orig;
+    settings_changed();
+    settings_flush();
+    printf("settings: %u records verified over %u slots\n\n",
+            20 * SETTINGS_SLOTS, SETTINGS_SLOTS);
+}
+
+/*
+ * Send a request frame with the given payload (and CRC, corrupted if bad is
+ * set) in binary mode and return the length of the response payload, checking
+ * the framing of the response. -1 if there was no response.
+ */
+static int proto_request(const u8 *req, u8 len, bool bad, u8 *resp)
+{
+    u8 frame[PROTO_MAX_LEN + 3], crc;
+    const u8 *out = (const u8 *)host_uart_output();
+    size_t size;
+
+    frame[0] = PROTO_SYNC;
+    frame[1] = len;
+    memcpy(&frame[2], req, len);
+    crc = 0;
+    for (int i = 1; i < len + 2; i++)
+        crc = _crc8_ccitt_update(crc, frame[i]);
+    frame[len + 2] = crc ^ bad;
+
+    host_uart_clear();
+    host_uart_receive_raw(frame, len + 3);
+    process_events();
+    display_wait();
+
+    size = host_uart_output_size();
+    if (size == 0)
+        return -1;
+    crc = 0;
+    for (size_t i = 1; i < size - 1; i++)
+        crc = _crc8_ccitt_update(crc, out[i]);
+    if (out[0] != PROTO_SYNC || size != out[1] + 3u || out[size - 1] != crc) {
+        fprintf(stderr, "proto check failed: bad response framing\n");
+        exit(1);
+    }
+    memcpy(resp, &out[2], out[1]);
+    host_uart_clear();
+    return out[1];
+}
+
+/* The same queries as "tg", "dg" and "bg", and back to text mode. */
+static const u8 proto_queries[] = {
+    PROTO_OP_TIME_GET, PROTO_OP_DATE_GET, PROTO_OP_BRIGHTNESS_GET,
+};
+static const u8 proto_text[] = { PROTO_OP_TEXT };
+
+static void run_frame(const u8 *req, u8 len)
+{
+    u8 resp[PROTO_MAX_RESP];
+
+    proto_request(req, len, false, resp);
+}
+
+static void check_response(const char *what, const u8 *resp, int len,
+        const u8 *want, int want_len)
+{
+    if (len != want_len || memcmp(resp, want, len)) {
+        fprintf(stderr, "proto check failed: %s:", what);
+        for (int i = 0; i < len; i++)
+            fprintf(stderr, " %02x", resp[i]);
+        fprintf(stderr, "\n");
+        exit(1);
+    }
+}
+
+/* "tg" gets a text response, so the UART is back in text mode. */
+static void check_text_mode(const char *what)
+{
+    host_uart_clear();
+    host_uart_receive("tg");
+    process_events();
+    if (strncmp(host_uart_output(), "tg\n", 3) ||
+            !strchr(host_uart_output() + 3, ':')) {
+        fprintf(stderr, "proto check failed: %s: still in binary mode\n",
+                what);
+        exit(1);
+    }
+    host_uart_clear();
+}
+
+/*
+ * Check the binary protocol against the text commands: a batch of requests
+ * (stopping at an unknown opcode), argument checking, truncated and corrupted
+ * frames, resyncing after a lost byte, setting date and time in one go, the
+ * aging offset, and switching back to text mode (also by power-down sleep).
+ * Also compares the bytes on the wire.
+ */
+static void verify_proto(void)
+{
+    static const u8 batch[] = {
+        PROTO_OP_TIME_GET,
+        PROTO_OP_DATE_GET,
+        PROTO_OP_BRIGHTNESS_SET, 3,
+        PROTO_OP_BRIGHTNESS_GET,
+        PROTO_OP_DATE_SET, 29, 2, 0xea, 0x07, /* 2026 is not a leap year */
+        PROTO_OP_BRIGHTNESS_SET, 9,
+        0x7f,
+        PROTO_OP_TIME_GET,
+    };
+    static const u8 truncated[] = { PROTO_OP_TIME_GET, PROTO_OP_TIME_SET, 1 };
+    static const u8 set_datetime[] = {
+        PROTO_OP_DATETIME_SET, 31, 12, 0x33, 0x08, 23, 59, 58, /* 2099 */
+        PROTO_OP_PING, 1, 2, 3, 4, 5, 6, 7,
+    };
+    static const u8 set_aging[] = { PROTO_OP_AGING_SET, (u8)-5 };
+    static const u8 ping[] = { PROTO_OP_PING, 1, 2, 3, 4, 5, 6, 7 };
+    /* A ping frame with a lost byte, and a sync byte in its argument */
+    static const u8 lost_byte[] = {
+        PROTO_SYNC, 8, PROTO_OP_PING, PROTO_SYNC, 1, 2, 3, 4,
+    };
+    unsigned long sec_writes;
+    const char *cmds[] = { "tg", "dg", "bg" };
+    u8 want[PROTO_MAX_RESP], resp[PROTO_MAX_RESP];
+    u8 brightness = settings.display_brightness;
+    struct datetime now;
+    size_t text_bytes = 0;
+    int len, n = 0;
+
+    rtc_read_datetime(&now, NULL, NULL);
+    run_command("bin");
+
+    len = proto_request(batch, sizeof(batch), false, resp);
+    want[n++] = PROTO_OP_TIME_GET;
+    want[n++] = PROTO_OK;
+    want[n++] = now.time.hour;
+    want[n++] = now.time.min;
+    want[n++] = now.time.sec;
+    want[n++] = PROTO_OP_DATE_GET;
+    want[n++] = PROTO_OK;
+    want[n++] = now.date.day;
+    want[n++] = now.date.month;
+    want[n++] = now.date.year & 0xff;
+    want[n++] = now.date.year >> 8;
+    want[n++] = PROTO_OP_BRIGHTNESS_SET;
+    want[n++] = PROTO_OK;
+    want[n++] = 3;
+    want[n++] = PROTO_OP_BRIGHTNESS_GET;
+    want[n++] = PROTO_OK;
+    want[n++] = 3;
+    want[n++] = PROTO_OP_DATE_SET;
+    want[n++] = PROTO_ERR_ARG;
+    want[n++] = PROTO_OP_BRIGHTNESS_SET;
+    want[n++] = PROTO_ERR_ARG;
+    want[n++] = 0x7f;
+    want[n++] = PROTO_ERR_OPCODE;
+    check_response("batch", resp, len, want, n);
+
+    len = proto_request(truncated, sizeof(truncated), false, resp);
+    n = 5;
+    want[n++] = PROTO_OP_TIME_SET;
+    want[n++] = PROTO_ERR_LEN;
+    check_response("truncated", resp, len, want, n);
+
+    len = proto_request(batch, sizeof(batch), true, resp);
+    want[0] = 0;
+    want[1] = PROTO_ERR_CRC;
+    check_response("bad CRC", resp, len, want, 2);
+
+    /* The next frame completes the broken one, and is still received. */
+    host_uart_receive_raw(lost_byte, sizeof(lost_byte));
+    process_events();
+    len = proto_request(ping, sizeof(ping), false, resp);
+    want[0] = PROTO_OP_PING;
+    want[1] = PROTO_OK;
+    memcpy(&want[2], &ping[1], 7);
+    check_response("lost byte", resp, len, want, 9);
+
+    /* Date and time in one write, which restarts the second once. */
+    sec_writes = host_rtc_sec_writes;
+    len = proto_request(set_datetime, sizeof(set_datetime), false, resp);
+    n = 0;
+    for (unsigned i = 0; i < sizeof(set_datetime); i += 8) {
+        want[n++] = set_datetime[i];
+        want[n++] = PROTO_OK;
+        memcpy(&want[n], &set_datetime[i + 1], 7);
+        n += 7;
+    }
+    check_response("datetime set", resp, len, want, n);
+    if (host_rtc_sec_writes != sec_writes + 1) {
+        fprintf(stderr, "proto check failed: seconds written %lu times\n",
+                host_rtc_sec_writes - sec_writes);
+        exit(1);
+    }
+    host_rtc_set(&now);
+
+    /* The aging offset takes effect with the conversion it starts. */
+    len = proto_request(set_aging, sizeof(set_aging), false, resp);
+    memcpy(want, set_aging, 1);
+    want[1] = PROTO_OK;
+    want[2] = set_aging[1];
+    check_response("aging set", resp, len, want, 3);
+    if (host_rtc_regs[0x10] != set_aging[1] || !(host_rtc_regs[0x0e] & 0x20)) {
+        fprintf(stderr, "proto check failed: aging %02x control %02x\n",
+                host_rtc_regs[0x10], host_rtc_regs[0x0e]);
+        exit(1);
+    }
+    host_rtc_regs[0x10] = 0;
+    host_rtc_regs[0x0e] &= ~0x20; /* Conversion done */
+
+    /* Bytes on the wire for the same three queries, text vs binary. */
+    for (unsigned i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        char buf[8];
+
+        strcpy(buf, cmds[i]);
+        host_uart_clear();
+        handle_command(buf);
+        /* The line, its echo and the response */
+        text_bytes += 2 * (strlen(buf) + 1) + host_uart_output_size();
+    }
+    host_uart_clear();
+    len = proto_request(proto_queries, sizeof(proto_queries), false, resp);
+    printf("proto: tg+dg+bg %zu bytes as text, %zu as a binary batch\n",
+            text_bytes, sizeof(proto_queries) + 3 + len + 3);
+
+    len = proto_request(proto_text, sizeof(proto_text), false, resp);
+    want[0] = PROTO_OP_TEXT;
+    want[1] = PROTO_OK;
+    check_response("text", resp, len, want, 2);
+    check_text_mode("text");
+
+    /* Power-down sleep in the middle of a frame ends binary mode too. */
+    run_command("bin");
+    host_uart_receive_raw(lost_byte, 4);
+    process_events();
+    uart_suspend();
+    uart_resume();
+    check_text_mode("power-down");
+
+    run_command("bs 0");
+    settings.display_brightness = brightness;
+    settings_changed();
+    printf("proto: batch, argument, truncation, CRC, resync, datetime, aging and "
+            "power-down checks passed\n\n");
+}
+
+/*
+ * Queue three buffers' worth of bytes at once, with interrupts disabled (so
+ * uart_putchar() polls the transmitter itself) and enabled (so it waits for
+ * the Tx interrupt). Without UART_TX_DROP all of them go out in order, after
+ * waiting a byte time for each that did not fit; with it those are dropped and
+ * counted instead. While waiting, the Rx interrupt echoes a byte into the
+ * room just made, which must not cost a byte of the sender's. A baud rate
+ * change waits until everything queued is sent.
+ */
+static void verify_uart_tx(void)
+{
+    /* The buffer holds one byte less than its size, and one is on the wire. */
+    const unsigned n = 3 * UART_TX_BUF_SIZE, fit = UART_TX_BUF_SIZE;
+    const unsigned sent = UART_TX_DROP ? fit : n;
+    double byte_us = 10e6 / uart_get_baud();
+    struct uart_stats before, after;
+    u32 baud = uart_get_baud(), other = baud == 19200 ? 9600 : 19200;
+
+    for (int irq = 0; irq < 2; irq++) {
+        unsigned echo = irq && !UART_TX_DROP;
+        double start, waited;
+        const char *out;
+
+        host_uart_clear();
+        uart_get_stats(&before);
+        if (echo)
+            host_uart_receive_in_wait('~');
+        start = host_now_us();
+        if (irq)
+            SREG |= 1 << SREG_I;
+        for (unsigned i = 0; i < n; i++)
+            uart_putchar('0' + i % 64);
+        SREG &= ~(1 << SREG_I);
+        waited = host_now_us() - start;
+        uart_get_stats(&after);
+
+        if (uart_tx_idle()) {
+            fprintf(stderr, "uart check failed: transmitter idle while sending\n");
+            exit(1);
+        }
+        out = host_uart_output();
+        for (unsigned i = 0, j = 0; i < sent; i++, j++) {
+            if (echo && out[j] == '~')
+                j++;
+            if ((u8)out[j] != '0' + i % 64) {
+                fprintf(stderr, "uart check failed: byte %u is %02x\n", i,
+                        (u8)out[j]);
+                exit(1);
+            }
+        }
+        if (host_uart_output_size() != sent + echo ||
+                (echo && !memchr(out, '~', sent + echo)) ||
+                (u16)(after.tx_dropped - before.tx_dropped) != n - sent ||
+                waited < (sent + echo - fit) * byte_us * 0.98 ||
+                waited > (sent + echo - fit) * byte_us * 1.02 || !uart_tx_idle()) {
+            fprintf(stderr, "uart check failed: %zu of %u bytes sent, %u "
+                    "dropped, waited %.0f us (interrupts %s)\n",
+                    host_uart_output_size(), n,
+                    (u16)(after.tx_dropped - before.tx_dropped), waited,
+                    irq ? "on" : "off");
+            exit(1);
+        }
+    }
+    /* Complete the line the echo started, and throw it away. */
+    host_uart_receive_byte('\n');
+    uart_set_recv_callback(NULL);
+    uart_process();
+    uart_set_recv_callback(handle_command);
+    events_take();
+    host_uart_clear();
+
+    uart_puts("baud");
+    uart_set_baud(other);
+    if (uart_get_baud() != baud) {
+        fprintf(stderr, "uart check failed: baud switched while sending\n");
+        exit(1);
+    }
+    host_uart_clear();
+    if (uart_get_baud() != other) {
+        fprintf(stderr, "uart check failed: baud not switched when idle\n");
+        exit(1);
+    }
+    uart_set_baud(baud);
+
+    printf("uart: %u bytes at once %s with interrupts off and on (%s)\n",
+            n, UART_TX_DROP ? "dropped the overflow" : "all sent in order",
+            UART_TX_DROP ? "UART_TX_DROP" : "waiting for room");
+}
+
+static char rx_lines[UART_RX_LINES + 2][32];
+static unsigned rx_n;
+
+static void record_line(char *msg)
+{
+    if (rx_n < sizeof(rx_lines) / sizeof(rx_lines[0]))
+        strcpy(rx_lines[rx_n], msg);
+    rx_n++;
+}
+
+/*
+ * Send lines back to back before the main loop gets to them: a line of the
+ * longest length that fits, one longer than that, enough to fill the queue
+ * and one more. The queued lines are handed out in order, and the others
+ * counted as overflowed and dropped. After an overrun reported by the
+ * controller (the byte before it lost) receiving carries on.
+ */
+static void verify_uart_rx(void)
+{
+    char longest[32], too_long[33], line[8];
+    struct uart_stats before, after;
+    unsigned want = 0;
+
+    memset(longest, 'a', sizeof(longest) - 1);
+    longest[sizeof(longest) - 1] = '\0';
+    memset(too_long, 'b', sizeof(too_long) - 1);
+    too_long[sizeof(too_long) - 1] = '\0';
+
+    uart_get_stats(&before);
+    uart_set_recv_callback(record_line);
+    rx_n = 0;
+    host_uart_receive(longest);
+    host_uart_receive(too_long);
+    for (unsigned i = 1; i <= UART_RX_LINES; i++) {
+        sprintf(line, "l%u", i);
+        host_uart_receive(line);
+    }
+    process_events();
+    host_uart_rx_overrun();
+    host_uart_receive("l9");
+    process_events();
+    uart_set_recv_callback(handle_command);
+    uart_get_stats(&after);
+    host_uart_clear();
+
+    if (rx_n != UART_RX_LINES + 1 || strcmp(rx_lines[want++], longest)) {
+        fprintf(stderr, "uart check failed: %u lines received\n", rx_n);
+        exit(1);
+    }
+    for (unsigned i = 1; i < UART_RX_LINES; i++) {
+        sprintf(line, "l%u", i);
+        if (strcmp(rx_lines[want++], line)) {
+            fprintf(stderr, "uart check failed: got \"%s\" for \"%s\"\n",
+                    rx_lines[want - 1], line);
+            exit(1);
+        }
+    }
+    if (strcmp(rx_lines[want], "l9") ||
+            after.rx_overflow - before.rx_overflow != 1 ||
+            after.rx_dropped - before.rx_dropped != 1 ||
+            after.rx_overrun - before.rx_overrun != 1) {
+        fprintf(stderr, "uart check failed: last \"%s\", overflow %u, "
+                "dropped %u, overrun %u\n", rx_lines[want],
+                after.rx_overflow - before.rx_overflow,
+                after.rx_dropped - before.rx_dropped,
+                after.rx_overrun - before.rx_overrun);
+        exit(1);
+    }
+    printf("uart: %u lines queued, overflow, dropped and overrun counted\n",
+            UART_RX_LINES);
+}
+
+/*
+ * Print the error of every supported baud rate at F_CPU and the slow clock,
+ * then switch rates with the text and binary commands. Only the default rate
+ * may let the power manager drop to the slow clock.
+ */
+static void verify_baud(void)
+{
+    static const struct uart_baud bauds[] = {
+        UART_BAUD_TABLE(UART_BAUD_ENTRY)
+    };
+    static const u8 req[] = { PROTO_OP_BAUD, 0x00, 0x96, 0x00, 0x00 };
+    u32 slow = SYSCLK_OSC >> SYSCLK_SLOW_SHIFT;
+    u32 fast = bauds[sizeof(bauds) / sizeof(bauds[0]) - 1].baud;
+    u8 resp[PROTO_MAX_RESP];
+    char cmd[16];
+
+    printf("uart: baud (error %%) at %lu Hz / %lu Hz:", (unsigned long)F_CPU,
+            (unsigned long)slow);
+    for (unsigned i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+        printf(" %lu (%.1f", (unsigned long)bauds[i].baud,
+                UART_BAUD_ERROR(F_CPU, bauds[i].baud, bauds[i].lbt) / 10.0);
+        if (UART_BAUD_ERROR(slow, bauds[i].baud, bauds[i].lbt) <=
+                UART_BAUD_MAX_ERROR)
+            printf(" / %.1f", UART_BAUD_ERROR(slow, bauds[i].baud,
+                        bauds[i].lbt) / 10.0);
+        printf(")");
+    }
+    printf("\n");
+
+    if (!uart_clock_ok(slow)) {
+        fprintf(stderr, "baud check failed: default rate not kept when slow\n");
+        exit(1);
+    }
+    sprintf(cmd, "baud %lu", (unsigned long)fast);
+    run_command(cmd);
+    if (uart_get_baud() != fast || uart_clock_ok(slow)) {
+        fprintf(stderr, "baud check failed: %s\n", cmd);
+        exit(1);
+    }
+    run_command("baud 12345");
+    if (uart_get_baud() != fast) {
+        fprintf(stderr, "baud check failed: unsupported rate accepted\n");
+        exit(1);
+    }
+
+    /* 38400 in a frame, then back to text mode and the default rate. */
+    run_command("bin");
+    proto_request(req, sizeof(req), false, resp);
+    if (uart_get_baud() != 38400 || resp[1] != PROTO_OK) {
+        fprintf(stderr, "baud check failed: binary request\n");
+        exit(1);
+    }
+    run_frame(proto_text, sizeof(proto_text));
+    run_command("baud 9600");
+    printf("uart: baud switching checks passed\n\n");
+}
+
+/*
+ * Simulate an hour of minute ticks the way the main loop runs them: handle the
+ * events, then sleep in events_wait() until the next tick. The display changes
+ * every minute. With listening set,
+ * the UART keeps the MCU out of power-down. Prints where the time went and the
+ * modelled average current.
+ */
+static void report_power(const char *name, bool listening)
+{
+    struct datetime dt = {
+        .date = { .day = 17, .month = 10, .year = 2026 },
+        .time = { .hour = 13, .min = 0, .sec = 0 },
+    };
+    static const char *const mode_names[] = {"active", "idle", "power-down"};
+    double us[HOST_NUM_MODES], nc[HOST_NUM_MODES];
+    double start = host_now_us(), total_us = 0, total_nc = 0;
+
+    memcpy(us, host_mode_us, sizeof(us));
+    memcpy(nc, host_mode_nc, sizeof(nc));
+
+    for (int m = 1; m <= 60; m++) {
+        host_wake_us = start + m * 60e6;
+        if (listening)
+            power_uart_activity();
+        dt.time.min = m % 60;
+        host_rtc_set(&dt);
+        INT1_vect();
+        while (host_now_us() < host_wake_us) {
+            process_events();
+            events_wait();
+        }
+    }
+
+    printf("power %-12s", name);
+    for (int i = 0; i < HOST_NUM_MODES; i++) {
+        us[i] = host_mode_us[i] - us[i];
+        nc[i] = host_mode_nc[i] - nc[i];
+        total_us += us[i];
+        total_nc += nc[i];
+    }
+    for (int i = 0; i < HOST_NUM_MODES; i++) {
+        printf(" %s %.3f%%", mode_names[i], 100 * us[i] / total_us);
+        if (us[i])
+            printf(" %.1f uA,", 1000 * nc[i] / us[i]);
+        else
+            printf(" -,");
+    }
+    printf(" average %.2f uA\n", 1000 * total_nc / total_us);
+
+    if (json) {
+        fprintf(json, "{\"power\": \"%s\"", name);
+        for (int i = 0; i < HOST_NUM_MODES; i++)
+            fprintf(json, ", \"%s_pct\": %.4f, \"%s_ua\": %.2f", mode_names[i],
+                    100 * us[i] / total_us, mode_names[i],
+                    us[i] ? 1000 * nc[i] / us[i] : 0);
+        fprintf(json, ", \"average_ua\": %.3f}\n", 1000 * total_nc / total_us);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct datetime now = {
+        .date = { .day = 17, .month = 10, .year = 2026 },
+        .time = { .hour = 12, .min = 34, .sec = 56 },
+    };
+    struct date epoch = { .day = 1, .month = 1, .year = 1900 };
+    struct date recent = { .day = 1, .month = 1, .year = 2019 };
+    struct datetime parsed;
+
+    if (argc > 1) {
+        json = fopen(argv[1], "w");
+        if (!json) {
+            perror(argv[1]);
+            return 1;
+        }
+        fprintf(json, "{\"version\": \"%s\", \"f_cpu\": %lu, "
+                "\"display_fast\": %d}\n", VERSION, (unsigned long)F_CPU,
+                DISP_FAST);
+    }
+
+    verify_calendar();
+
+    host_rtc_set(&now);
+    init();
+    uart_init();
+    uart_set_recv_callback(handle_command);
+    twi_init();
+    rtc_init();
+    display_init();
+    display_wait();
+    verify_display();
+    verify_settings();
+    verify_proto();
+    verify_uart_tx();
+    verify_uart_rx();
+    verify_baud();
+
+    printf("Host ns/call is this machine running gcc -O2 code, to compare "
+            "algorithms only;\nmake bench-avr counts AVR cycles.\n");
+    printf("%-28s %9s %12s %14s %12s %10s %10s\n", "benchmark", "calls",
+            "host ns/call", "device us/call", "sleep us/call", "twi B/call",
+            "eep B/call");
+
+    BENCH("date_diff_days 1900 (ref)", 1000,
+            sink = ref_date_diff_days(&epoch, &now.date));
+    BENCH("date_diff_days 1900", 1000000,
+            sink = date_diff_days(&epoch, &now.date));
+    BENCH("date_diff_days 2019 (ref)", 10000,
+            sink = ref_date_diff_days(&recent, &now.date));
+    BENCH("date_diff_days 2019", 1000000,
+            sink = date_diff_days(&recent, &now.date));
+    BENCH("date_from_days", 1000000,
+            date_from_days(___i % 73049, &parsed.date));
+    BENCH("datetime_from_string", 1000000,
+            datetime_from_string("17-10-2026 12:34:56", &parsed);
+            sink = parsed.date.year);
+    BENCH("display_shownum", 100000,
+            display_shownum(___i % 2400, true, true, 1));
+    display_wait();
+    BENCH("display_shownum + wait", 100000,
+            display_shownum(___i % 2400, true, true, 1); display_wait());
+    BENCH("display_shownum minute", 100000,
+            display_shownum(1200 + ___i % 10, true, true, 1); display_wait());
+    BENCH("display_shownum unchanged", 100000,
+            display_shownum(1234, true, true, 1); display_wait());
+    BENCH("handle_command tg", 10000, run_command("tg"));
+    BENCH("handle_command dg", 10000, run_command("dg"));
+    BENCH("handle_command dtg", 10000, run_command("dtg"));
+    BENCH("handle_command ts", 10000, run_command("ts 12:34:56"));
+    BENCH("rtc_read_time", 10000, rtc_read_time(&parsed.time));
+    BENCH("rtc_read_datetime", 10000, rtc_read_datetime(&parsed, NULL, NULL));
+    BENCH("update_display", 10000, update_display(); display_wait());
+    BENCH("handle_command bs", 10000, run_command("bs 3"));
+    BENCH("handle_command tg+dg+bg", 10000,
+            run_command("tg"); run_command("dg"); run_command("bg"));
+    run_command("bin");
+    BENCH("proto frame tg+dg+bg", 10000,
+            run_frame(proto_queries, sizeof(proto_queries)));
+    run_frame(proto_text, sizeof(proto_text));
+    BENCH("bs burst + flush", 1000,
+            for (int j = 0; j < 8; j++) {
+                char cmd[] = "bs 0";
+                cmd[3] += j;
+                run_command(cmd);
+            }
+            settings_flush());
+    BENCH("handle_command dds", 1000,
+            run_command("dds 01-01-1900 00:00:00"));
+    BENCH("handle_command dde 1", 1000, run_command("dde 1"));
+    BENCH("INT1_vect (ISR only)", 100000, INT1_vect(); events_take());
+    BENCH("INT1 tick (datediff)", 1000, INT1_vect(); process_events(); display_wait());
+    BENCH("handle_command dde 0", 1000, run_command("dde 0"));
+    BENCH("INT1 tick (time)", 10000, INT1_vect(); process_events(); display_wait());
+    run_command("clk 1");
+    BENCH("INT1 tick (soft clock)", 10000, INT1_vect(); process_events(); display_wait());
+    run_command("clk 0");
+
+    printf("\n");
+    report_power("listening", true);
+    report_power("standby", false);
+
+#if ISR_STATS
+    {
+        char cmd[] = "stats";
+
+        host_uart_clear();
+        handle_command(cmd);
+        printf("\n%s", host_uart_output());
+        host_uart_clear();
+    }
+#endif
+
+    if (json)
+        fclose(json);
+    return 0;
+}
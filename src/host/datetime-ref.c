@@ -0,0 +1,41 @@
+/*
+ * Reference calendar code, see datetime-ref.h.
+ */
+
+#include "datetime-ref.h"
+
+void ref_date_next(struct date *date)
+{
+    static const u8 month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31,
+                                    30, 31};
+    u8 days = month_days[date->month - 1];
+
+    if (date->month == 2 && date_year_is_leap(date->year))
+        days++;
+    if (++date->day > days) {
+        date->day = 1;
+        if (++date->month > 12) {
+            date->month = 1;
+            date->year++;
+        }
+    }
+}
+
+u16 ref_date_diff_days(struct date *date1, struct date *date2)
+{
+    struct date iter, target;
+    u16 days = 0;
+
+    if (date_cmp(date1, date2) < 0) {
+        iter = *date1;
+        target = *date2;
+    } else {
+        iter = *date2;
+        target = *date1;
+    }
+    while (date_cmp(&iter, &target)) {
+        ref_date_next(&iter);
+        days++;
+    }
+    return days;
+}
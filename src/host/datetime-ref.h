@@ -0,0 +1,13 @@
+#ifndef HOST_DATETIME_REF_H
+#define HOST_DATETIME_REF_H
+
+#include "../datetime.h"
+
+/*
+ * The original iterative implementation of date_diff_days(), kept as reference
+ * for the closed-form day numbers in datetime.c. Also built for make bench-avr.
+ */
+void ref_date_next(struct date *date);
+u16 ref_date_diff_days(struct date *date1, struct date *date2);
+
+#endif
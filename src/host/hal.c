@@ -0,0 +1,164 @@
+/*
+ * Host backing store for the AVR registers and EEPROM routines.
+ */
+
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+
+#include "host.h"
+
+volatile uint8_t DDRA, PORTA, PINA;
+volatile uint8_t DDRB, PORTB, PINB;
+volatile uint8_t EICRA, EIMSK, EIFR;
+volatile uint8_t SREG;
+volatile uint16_t SP = RAMEND;
+volatile uint8_t CLKPR = 3;
+volatile uint8_t PRR;
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t LINCR, LINSIR, LINENIR, LINERR, LINBTR;
+volatile uint8_t LINBRRL, LINBRRH, LINDAT;
+
+double host_delay_us;
+double host_sleep_us;
+unsigned long host_eeprom_writes;
+int host_sleep_mode;
+double host_wake_us;
+double host_mode_us[HOST_NUM_MODES];
+double host_mode_nc[HOST_NUM_MODES];
+
+/*
+ * Supply current (mA), roughly the typical ATtiny87 figures at 1 MHz and 5V: a
+ * base current per mode plus, while not powered down, that of every module
+ * whose PRR bit is clear. Both scale with the clock (8 MHz >> CLKPR).
+ */
+static const double mode_ma[HOST_NUM_MODES] = {
+    [HOST_ACTIVE] = 0.80,
+    [HOST_IDLE] = 0.12,
+    [HOST_POWER_DOWN] = 0.001,
+};
+static const double module_ma[8] = {
+    [PRADC] = 0.060,
+    [PRUSI] = 0.015,
+    [PRTIM0] = 0.015,
+    [PRTIM1] = 0.030,
+    [PRSPI] = 0.030,
+    [PRLIN] = 0.040,
+};
+
+static void account(int mode, double us)
+{
+    double ma = mode_ma[mode];
+
+    if (mode != HOST_POWER_DOWN) {
+        for (int i = 0; i < 8; i++) {
+            if (!(PRR & (1 << i)))
+                ma += module_ma[i];
+        }
+        ma *= 8.0 / (1 << (CLKPR & 0xf));
+    }
+    host_mode_us[mode] += us;
+    host_mode_nc[mode] += ma * us;
+}
+
+double host_now_us(void)
+{
+    return host_delay_us + host_sleep_us;
+}
+
+void host_busy(double us)
+{
+    host_delay_us += us;
+    account(HOST_ACTIVE, us);
+}
+
+/* Provided by the drivers that use the corresponding timer. */
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+
+static const unsigned timer1_prescaler[] = { 0, 1, 8, 64, 256, 1024 };
+
+/*
+ * The CPU sleeps until the next interrupt. The interrupt sources we simulate
+ * are Timer1 in CTC mode and the LIN/UART finishing a byte: skip ahead to
+ * whichever comes first. In power-down, or without either running, we sleep
+ * until host_wake_us, when the harness delivers whatever external interrupt
+ * it simulates.
+ */
+void host_sleep(void)
+{
+    int mode = host_sleep_mode == SLEEP_MODE_PWR_DOWN ? HOST_POWER_DOWN :
+            HOST_IDLE;
+    unsigned cs = TCCR1B & 7;
+    double us, timer_us = -1, uart_us = -1;
+
+    if (mode == HOST_IDLE && cs && cs < 6 && (TIMSK1 & (1<<OCIE1A)) &&
+            TIMER1_COMPA_vect)
+        timer_us = (OCR1A + 1.0 - TCNT1) * timer1_prescaler[cs] * 1e6 / F_CPU;
+    if (mode == HOST_IDLE)
+        uart_us = host_uart_tx_wait_us();
+
+    if (uart_us >= 0 && (timer_us < 0 || uart_us < timer_us)) {
+        account(mode, uart_us);
+        host_sleep_us += uart_us;
+        if (timer_us >= 0)
+            TCNT1 += uart_us * F_CPU / 1e6 / timer1_prescaler[cs];
+        host_uart_tx_done();
+    } else if (timer_us >= 0) {
+        account(mode, timer_us);
+        host_sleep_us += timer_us;
+        TCNT1 = 0;
+        TIMER1_COMPA_vect();
+    } else if (host_wake_us > host_now_us()) {
+        us = host_wake_us - host_now_us();
+        account(mode, us);
+        host_sleep_us += us;
+    }
+}
+
+#define EEPROM_WRITE_US 3400
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+    return *p;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+    *p = value;
+    host_eeprom_writes++;
+    host_busy(EEPROM_WRITE_US);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+
+    while (n--)
+        eeprom_write_byte(d++, *s++);
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+    if (*p != value)
+        eeprom_write_byte(p, value);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+
+    while (n--)
+        eeprom_update_byte(d++, *s++);
+}
@@ -0,0 +1,111 @@
+/*
+ * Glue for building the firmware on a Linux host (make host / make bench).
+ *
+ * This header is force-included into every host translation unit. It exposes
+ * the state of the simulated hardware so the harness can drive and inspect it.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdio.h>
+
+#include "../types.h"
+
+/*
+ * avr-libc lets us declare a FILE by value (see uart.c); glibc does not, so on
+ * the host uart_fd refers to a stream created with fopencookie() by the
+ * uart_init() of uart-host.c, which wraps that of uart.c.
+ */
+extern FILE *host_uart_stream;
+#define uart_fd (*host_uart_stream)
+#define FDEV_SETUP_STREAM(put, get, rwflag) NULL
+void firmware_uart_init(void);
+
+/* Time (us) the MCU would have spent in _delay_us/_delay_ms or on the bus. */
+extern double host_delay_us;
+
+/* Time (us) the MCU spent asleep waiting for (simulated) interrupts. */
+extern double host_sleep_us;
+
+/*
+ * Time (us) spent and charge (nC) used per power mode, from a model of the
+ * supply current in each mode with the modules enabled in PRR. Time the CPU
+ * spends computing (outside _delay_* and bus transfers) is not simulated.
+ */
+enum {
+    HOST_ACTIVE,
+    HOST_IDLE,
+    HOST_POWER_DOWN,
+    HOST_NUM_MODES,
+};
+extern double host_mode_us[HOST_NUM_MODES];
+extern double host_mode_nc[HOST_NUM_MODES];
+
+/* Busy-wait for us; the current time, host_delay_us + host_sleep_us. */
+void host_busy(double us);
+double host_now_us(void);
+
+/*
+ * When there is nothing for the simulated timers to do, sleeping lasts until
+ * this time (us), when the harness delivers an external interrupt.
+ */
+extern double host_wake_us;
+
+/* Number of EEPROM bytes written. */
+extern unsigned long host_eeprom_writes;
+
+/* Number of bytes (including address bytes) transferred over TWI. */
+extern unsigned long host_twi_bytes;
+
+/* Registers of the simulated DS3231. */
+#define HOST_RTC_NUM_REGS 0x13
+extern u8 host_rtc_regs[HOST_RTC_NUM_REGS];
+void host_rtc_set(const struct datetime *dt);
+
+/* Writes to the seconds register, each restarting the current second. */
+extern unsigned long host_rtc_sec_writes;
+
+/*
+ * The TM1637 model (tm1637.c), which the display driver reports every change
+ * of CLK and DIO to. Besides the display registers it keeps the result of
+ * checking the edges against the protocol and the datasheet timings.
+ */
+struct host_tm1637 {
+    u8 segs[6];
+    u8 ctrl;
+    u8 nack;                /* Number of upcoming bytes not to ACK */
+    unsigned long commands;
+    unsigned long bytes;
+    unsigned long errors;
+    double min_clk_pulse_us;
+    double min_setup_us;
+    double min_hold_us;
+};
+extern struct host_tm1637 host_tm1637;
+void host_tm1637_trace(void);
+#define DISP_TRACE() host_tm1637_trace()
+
+/*
+ * The LIN/UART model (uart-host.c) that uart.c runs on. Received bytes raise
+ * the Rx interrupt right away. Sent bytes take their time on the wire only
+ * while the CPU sleeps or waits for the transmitter; the harness functions
+ * below see everything queued as sent.
+ */
+void host_uart_receive(const char *line);
+void host_uart_receive_raw(const u8 *buf, size_t len);
+void host_uart_receive_byte(u8 c);
+void host_uart_rx_overrun(void);
+void host_uart_receive_in_wait(u8 c);
+const char *host_uart_output(void);
+size_t host_uart_output_size(void);
+void host_uart_clear(void);
+void host_uart_set_stdout(bool on);
+
+/* Time (us) until the byte being sent is done, or -1 if none; finish it. */
+double host_uart_tx_wait_us(void);
+void host_uart_tx_done(void);
+void host_uart_wait(void);
+#define UART_TX_WAIT() host_uart_wait()
+
+#endif
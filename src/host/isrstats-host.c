@@ -0,0 +1,20 @@
+/*
+ * Host time base for isrstats.c: the simulated time, in the same ticks as
+ * Timer0 would count on the AVR.
+ */
+
+#include "../isrstats.h"
+#include "host.h"
+
+#if ISR_STATS
+
+void isrstats_timer_init(void)
+{
+}
+
+u16 isrstats_now(void)
+{
+    return (u16)(unsigned long)(host_now_us() / ISRSTATS_TICK_US);
+}
+
+#endif
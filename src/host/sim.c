@@ -0,0 +1,208 @@
+/*
+ * The firmware behind a pseudo-terminal, as a stand-in for a clock on a serial
+ * port to run control.py against (make sim).
+ *
+ * It prints the name of the terminal, or makes the symlink given as argument
+ * point to it, and then serves it until killed. The simulated RTC starts at
+ * the host's local time and runs on the host's clock, or fast by the ppm given
+ * with -d less 0.1 ppm per step of its aging offset. Like the DS3231, writing
+ * its seconds register restarts the current second. Baud rates are accepted
+ * but mean nothing on a pty.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "../datetime.h"
+#include "../display.h"
+#include "../uart.h"
+#include "../twi.h"
+#include "../rtc.h"
+#include "host.h"
+
+/* From main.c */
+void init(void);
+void handle_command(char *msg);
+void process_events(void);
+void INT1_vect(void);
+
+static double drift_ppm;
+
+static double wall_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static u8 bcd_decode(u8 bcd)
+{
+    return (bcd >> 4) * 10 + (bcd & 0xf);
+}
+
+/* Length (s) of a second of the RTC, with its aging offset (register 0x10). */
+static double rtc_second(void)
+{
+    return 1 / (1 + (drift_ppm - 0.1 * (s8)host_rtc_regs[0x10]) * 1e-6);
+}
+
+/* Advance the RTC by a second, raising the minute alarm when it is enabled. */
+static void rtc_tick(void)
+{
+    struct tm tm = {
+        .tm_sec = bcd_decode(host_rtc_regs[0x00]),
+        .tm_min = bcd_decode(host_rtc_regs[0x01]),
+        .tm_hour = bcd_decode(host_rtc_regs[0x02]),
+        .tm_mday = bcd_decode(host_rtc_regs[0x04]),
+        .tm_mon = bcd_decode(host_rtc_regs[0x05] & 0x7f) - 1,
+        .tm_year = bcd_decode(host_rtc_regs[0x06]) +
+                   (host_rtc_regs[0x05] & 0x80 ? 100 : 0),
+    };
+    time_t t = timegm(&tm) + 1;
+    struct datetime dt;
+
+    gmtime_r(&t, &tm);
+    dt.date.day = tm.tm_mday;
+    dt.date.month = tm.tm_mon + 1;
+    dt.date.year = tm.tm_year + 1900;
+    dt.time.hour = tm.tm_hour;
+    dt.time.min = tm.tm_min;
+    dt.time.sec = tm.tm_sec;
+    host_rtc_set(&dt);
+
+    if (tm.tm_sec == 0 && (EIMSK & (1 << INT1)))
+        INT1_vect();
+}
+
+static int open_pty(const char **name)
+{
+    struct termios tio;
+    int fd;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd) || !(*name = ptsname(fd)))
+        return -1;
+
+    /* Raw bytes both ways, like a UART. */
+    if (tcgetattr(fd, &tio))
+        return -1;
+    cfmakeraw(&tio);
+    if (tcsetattr(fd, TCSANOW, &tio))
+        return -1;
+
+    /* Keep the other side open ourselves, so reads do not fail between
+     * clients. */
+    if (open(*name, O_RDWR | O_NOCTTY) < 0)
+        return -1;
+    return fd;
+}
+
+static void send_output(int fd)
+{
+    const char *out = host_uart_output();
+    size_t size = host_uart_output_size();
+
+    while (size) {
+        ssize_t n = write(fd, out, size);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        out += n;
+        size -= n;
+    }
+    host_uart_clear();
+}
+
+int main(int argc, char **argv)
+{
+    time_t t = time(NULL);
+    struct tm *tm = localtime(&t);
+    struct datetime now = {
+        .date = { .day = tm->tm_mday, .month = tm->tm_mon + 1,
+                  .year = tm->tm_year + 1900 },
+        .time = { .hour = tm->tm_hour, .min = tm->tm_min, .sec = tm->tm_sec },
+    };
+    const char *name;
+    unsigned long sec_writes;
+    double tick;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        if (opt != 'd') {
+            fprintf(stderr, "usage: %s [-d ppm] [link]\n", argv[0]);
+            return 1;
+        }
+        drift_ppm = atof(optarg);
+    }
+
+    fd = open_pty(&name);
+    if (fd < 0) {
+        perror("pty");
+        return 1;
+    }
+    if (optind < argc) {
+        unlink(argv[optind]);
+        if (symlink(name, argv[optind])) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    printf("%s\n", name);
+    fflush(stdout);
+
+    host_rtc_set(&now);
+    tick = t + rtc_second();
+    init();
+    uart_init();
+    uart_set_recv_callback(handle_command);
+    twi_init();
+    rtc_init();
+    rtc_enable_notifier();
+    display_init();
+    display_wait();
+    host_uart_clear();
+
+    while (1) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        double wait = tick - wall_s();
+        u8 buf[64];
+        ssize_t n = 0;
+
+        if (wait <= 0) {
+            rtc_tick();
+            tick += rtc_second();
+        } else if (ppoll(&pfd, 1, &(struct timespec){ .tv_sec = wait,
+                        .tv_nsec = (wait - (long)wait) * 1e9 }, NULL) > 0) {
+            n = read(fd, buf, sizeof(buf));
+        }
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            return 1;
+        }
+
+        sec_writes = host_rtc_sec_writes;
+        for (ssize_t i = 0; i < n; i++) {
+            host_uart_receive_byte(buf[i]);
+            process_events();
+        }
+        process_events();
+        display_wait();
+        if (host_rtc_sec_writes != sec_writes)
+            tick = wall_s() + rtc_second();
+        send_output(fd);
+    }
+}
@@ -0,0 +1,18 @@
+/*
+ * Host implementation of stack.h. The host has no AVR RAM layout to measure,
+ * so only the (always zero) ISR depths are reported.
+ */
+
+#include <string.h>
+
+#include "../stack.h"
+#include "host.h"
+
+volatile u16 stack_isr_depth[STACK_NUM_ISRS];
+
+void stack_get_stats(struct stack_stats *ret)
+{
+    memset(ret, 0, sizeof(*ret));
+    for (int i = 0; i < STACK_NUM_ISRS; i++)
+        ret->isr_depth[i] = stack_isr_depth[i];
+}
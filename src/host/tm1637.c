@@ -0,0 +1,197 @@
+/*
+ * Model of a TM1637 on the display lines, fed by the driver through
+ * DISP_TRACE() after every change of CLK or DIO.
+ *
+ * It acts as the device (ACKing bytes and decoding commands into its display
+ * registers) and at the same time checks the edge sequence against the
+ * datasheet: start/stop conditions, data only changing while CLK is low, DIO
+ * released for the ACK, and the minimum clock pulse width and data setup/hold
+ * times.
+ */
+
+#include <stdlib.h>
+
+#include "../pins.h"
+#include "host.h"
+
+/* Minimum timings from the TM1637 datasheet (us). */
+#define T_CLK_PULSE 0.4
+#define T_SETUP 0.1
+#define T_HOLD 0.1
+
+/* An sbi/cbi takes two cycles, so consecutive pin changes are that far apart. */
+#define PIN_OP_US (2e6 / F_CPU)
+
+struct host_tm1637 host_tm1637 = {
+    .min_clk_pulse_us = 1e9,
+    .min_setup_us = 1e9,
+    .min_hold_us = 1e9,
+};
+
+static bool clk = true, dio = true; /* Line levels */
+static bool dio_master = true;      /* Level the MCU drives DIO to */
+static double t_last, t_clk, t_dio; /* Time of last change of any/CLK/DIO */
+
+static bool in_frame;
+static u8 nbits;        /* CLK rising edges in the current byte, 8 = ACK clock */
+static u8 shift;
+static bool ack_drive;  /* We are pulling DIO low to ACK */
+static u8 cmd_bytes;    /* Bytes received in the current command */
+static u8 cmd;
+static u8 addr;
+static bool auto_inc = true;
+
+static void error(const char *msg)
+{
+    host_tm1637.errors++;
+    fprintf(stderr, "tm1637: %s (byte %lu, bit %u)\n", msg, host_tm1637.bytes,
+            nbits);
+}
+
+static void check_min(double dt, double min, double *seen, const char *what)
+{
+    if (dt < *seen)
+        *seen = dt;
+    if (dt < min)
+        error(what);
+}
+
+static void receive_byte(u8 b)
+{
+    host_tm1637.bytes++;
+
+    if (cmd_bytes++ == 0) {
+        cmd = b;
+        switch (b & 0xc0) {
+        case 0x40:
+            auto_inc = !(b & 0x04);
+            break;
+        case 0x80:
+            host_tm1637.ctrl = b;
+            break;
+        case 0xc0:
+            addr = b & 0x07;
+            break;
+        default:
+            error("invalid command");
+        }
+        return;
+    }
+
+    if ((cmd & 0xc0) != 0xc0) {
+        error("data after non-address command");
+        return;
+    }
+    if (addr >= sizeof(host_tm1637.segs)) {
+        error("address out of range");
+        return;
+    }
+    host_tm1637.segs[addr] = b;
+    if (auto_inc)
+        addr++;
+}
+
+static void clk_edge(bool rising, double now)
+{
+    if (rising) {
+        check_min(now - t_clk, T_CLK_PULSE, &host_tm1637.min_clk_pulse_us,
+                "CLK low pulse too short");
+        check_min(now - t_dio, T_SETUP, &host_tm1637.min_setup_us,
+                "data setup time too short");
+        if (!in_frame)
+            return;
+        if (nbits < 8) {
+            shift |= dio << nbits;
+        } else if (nbits == 8) {
+            if (PINS_DDR(PIN_DISP_DIO) & pin_to_mask(PIN_DISP_DIO))
+                error("DIO not released for ACK");
+            receive_byte(shift);
+        }
+        nbits++;
+    } else {
+        check_min(now - t_clk, T_CLK_PULSE, &host_tm1637.min_clk_pulse_us,
+                "CLK high pulse too short");
+        if (!in_frame)
+            return;
+        if (nbits == 0) {
+            /* End of the start condition */
+            check_min(now - t_dio, T_HOLD, &host_tm1637.min_hold_us,
+                    "start hold time too short");
+        } else if (nbits == 8) {
+            if (host_tm1637.nack)
+                host_tm1637.nack--;
+            else
+                ack_drive = true;
+        } else if (nbits == 9) {
+            ack_drive = false;
+            nbits = 0;
+            shift = 0;
+        }
+    }
+}
+
+static void dio_edge(bool rising, double now)
+{
+    if (!clk) {
+        check_min(now - t_clk, T_HOLD, &host_tm1637.min_hold_us,
+                "data hold time too short");
+        return;
+    }
+
+    check_min(now - t_clk, T_SETUP, &host_tm1637.min_setup_us,
+            rising ? "stop setup time too short" : "start setup time too short");
+    if (!rising) {
+        if (in_frame)
+            error("start condition inside a frame");
+        in_frame = true;
+        nbits = 0;
+        shift = 0;
+        cmd_bytes = 0;
+    } else {
+        /* The stop is preceded by one clock, which does not start a byte. */
+        if (!in_frame)
+            error("stop condition outside a frame");
+        else if (nbits != 1 || cmd_bytes == 0)
+            error("stop condition in the middle of a byte");
+        else
+            host_tm1637.commands++;
+        in_frame = false;
+    }
+}
+
+void host_tm1637_trace(void)
+{
+    bool new_clk = !(PINS_DDR(PIN_DISP_CLK) & pin_to_mask(PIN_DISP_CLK));
+    bool new_dio_master =
+        !(PINS_DDR(PIN_DISP_DIO) & pin_to_mask(PIN_DISP_DIO));
+    bool new_dio;
+    double now = host_sleep_us + host_delay_us;
+
+    if (now < t_last + PIN_OP_US)
+        now = t_last + PIN_OP_US;
+
+    if (new_clk != clk) {
+        clk_edge(new_clk, now);
+        clk = new_clk;
+        t_clk = t_last = now;
+    }
+
+    /* ACK driving follows CLK, so DIO is evaluated after it. */
+    new_dio = new_dio_master && !ack_drive;
+    if (new_dio != dio) {
+        /* Changes caused by our own ACK are not held to the MCU's timing. */
+        if (new_dio_master != dio_master)
+            dio_edge(new_dio, now);
+        dio = new_dio;
+        t_dio = t_last = now;
+    }
+    dio_master = new_dio_master;
+
+    /* What the MCU reads back from the pins. */
+    PINS_IN(PIN_DISP_CLK) &= ~pin_to_mask(PIN_DISP_CLK);
+    if (clk)
+        PINS_IN(PIN_DISP_CLK) |= pin_to_mask(PIN_DISP_CLK);
+    PINS_IN(PIN_DISP_DIO) &= ~pin_to_mask(PIN_DISP_DIO);
+    if (dio)
+        PINS_IN(PIN_DISP_DIO) |= pin_to_mask(PIN_DISP_DIO);
+}
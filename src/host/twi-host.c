@@ -0,0 +1,136 @@
+/*
+ * Host implementation of twi.h, with a register-level model of a DS3231 on
+ * the bus. Each transferred bit is charged the SCL timing of twi-usi.c, and
+ * the USI is powered from START to STOP like there.
+ */
+
+#include <avr/power.h>
+
+#include "../twi.h"
+#include "host.h"
+
+#define DS3231_ADDR 0x68
+
+/* delay_long + delay_short per SCL period in twi-usi.c */
+#define SCL_PERIOD_US 9
+
+unsigned long host_twi_bytes;
+u8 host_rtc_regs[HOST_RTC_NUM_REGS];
+unsigned long host_rtc_sec_writes;
+
+static u8 reg_ptr;
+static bool last_ok = true;
+static bool selected;
+static bool ptr_pending;
+
+static void bus_byte(void)
+{
+    host_twi_bytes++;
+    host_busy(9 * SCL_PERIOD_US); /* 8 data bits + ACK */
+}
+
+static u8 bcd(u8 v)
+{
+    return ((v / 10) << 4) | (v % 10);
+}
+
+void host_rtc_set(const struct datetime *dt)
+{
+    u16 year = dt->date.year - 1900;
+
+    host_rtc_regs[0x00] = bcd(dt->time.sec);
+    host_rtc_regs[0x01] = bcd(dt->time.min);
+    host_rtc_regs[0x02] = bcd(dt->time.hour);
+    host_rtc_regs[0x04] = bcd(dt->date.day);
+    host_rtc_regs[0x05] = bcd(dt->date.month) | (year >= 100 ? 0x80 : 0);
+    host_rtc_regs[0x06] = bcd(year % 100);
+    host_rtc_regs[0x11] = 21;
+    host_rtc_regs[0x12] = 0x40;
+}
+
+void twi_init(void)
+{
+    selected = false;
+}
+
+bool twi_start(u8 addr, bool do_read)
+{
+    power_usi_enable();
+    host_busy(SCL_PERIOD_US);
+    bus_byte();
+    selected = addr == DS3231_ADDR;
+    ptr_pending = selected && !do_read;
+    return selected;
+}
+
+void twi_stop(void)
+{
+    host_busy(SCL_PERIOD_US);
+    selected = false;
+    power_usi_disable();
+}
+
+bool twi_write(u8 data)
+{
+    bus_byte();
+    if (!selected)
+        return false;
+    if (ptr_pending) {
+        reg_ptr = data % HOST_RTC_NUM_REGS;
+        ptr_pending = false;
+    } else {
+        if (reg_ptr == 0)
+            host_rtc_sec_writes++;
+        host_rtc_regs[reg_ptr] = data;
+        reg_ptr = (reg_ptr + 1) % HOST_RTC_NUM_REGS;
+    }
+    return true;
+}
+
+u8 twi_read(bool last_read)
+{
+    u8 data;
+
+    (void)last_read;
+    bus_byte();
+    if (!selected)
+        return 0xff;
+    data = host_rtc_regs[reg_ptr];
+    reg_ptr = (reg_ptr + 1) % HOST_RTC_NUM_REGS;
+    return data;
+}
+
+/*
+ * The transfer API on top of the blocking primitives; the transfer has
+ * completed (and cb has been called) by the time this returns.
+ */
+bool twi_transfer_async(u8 addr, u8 flags, u8 *buf, u8 len, twi_done_cb_t cb)
+{
+    bool ok = true;
+
+    if (!(flags & TWI_NOSTART))
+        ok = twi_start(addr, flags & TWI_READ);
+    while (ok && len--) {
+        if (flags & TWI_READ)
+            *buf++ = twi_read(!len && !(flags & TWI_READ_MORE));
+        else
+            ok = twi_write(*buf++);
+    }
+    if (!ok || !(flags & TWI_NOSTOP))
+        twi_stop();
+
+    last_ok = ok;
+    if (cb)
+        cb(ok);
+    return true;
+}
+
+bool twi_busy(void)
+{
+    return false;
+}
+
+bool twi_wait(void)
+{
+    return last_ok;
+}
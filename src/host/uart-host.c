@@ -0,0 +1,220 @@
+/*
+ * Host model of the LIN/UART controller, which uart.c is built against. The
+ * harness injects received bytes through host_uart_receive*(), which raise the
+ * Rx interrupt like the controller does, and collects what was sent.
+ *
+ * A byte written to LINDAT is on the wire until the model completes it: after
+ * its time at the current baud rate while the CPU sleeps (host_sleep()) or
+ * busy-waits for the transmitter, or right away when the harness looks at the
+ * output. Completing a byte sets LTXOK and, while LENTXOK is set, raises the
+ * Tx interrupt, which sends the next. The transmitter runs exactly when
+ * LENTXOK is set (see uart.c), so then LINDAT holds the byte on the wire
+ * until the model has taken it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/power.h>
+
+#include "../uart.h"
+#include "../sysclk.h"
+#include "host.h"
+
+void LIN_TC_vect(void);
+
+#define OUT_BUF_MAX 4096
+static char out_buf[OUT_BUF_MAX];
+static size_t out_buf_size;
+static bool to_stdout;
+
+static int tx_shift = -1;   /* The byte on the wire, if any */
+static double tx_done_us;   /* When it is done */
+static bool rx_overrun;
+static int rx_in_wait = -1;
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t size)
+{
+    (void)cookie;
+    for (size_t i = 0; i < size; i++)
+        uart_putchar(buf[i]);
+    return size;
+}
+
+/* uart.c makes uart_fd stdout as well, which the harness keeps for itself. */
+void uart_init(void)
+{
+    cookie_io_functions_t funcs = { .write = stream_write };
+    FILE *out = stdout, *err = stderr;
+
+    host_uart_stream = fopencookie(NULL, "w", funcs);
+    setvbuf(host_uart_stream, NULL, _IONBF, 0);
+    firmware_uart_init();
+    stdout = out;
+    stderr = err;
+}
+
+/* Time of a byte (start, 8 data and stop bits) as the registers set it up. */
+static double byte_us(void)
+{
+    unsigned div = (LINBRRH << 8 | LINBRRL) + 1;
+
+    return 10.0 * (LINBTR & 0x3f) * div * 1e6 / sysclk_hz();
+}
+
+/* Put a byte uart.c wrote to LINDAT on the wire. */
+static void tx_take(void)
+{
+    if (tx_shift < 0 && (LINENIR & (1 << LENTXOK)) &&
+            !(PRR & (1 << PRLIN))) {
+        tx_shift = LINDAT;
+        tx_done_us = host_now_us() + byte_us();
+    }
+}
+
+static void tx_complete(bool irq)
+{
+    if (out_buf_size == OUT_BUF_MAX - 1)
+        out_buf_size = 0;
+    out_buf[out_buf_size++] = tx_shift;
+    out_buf[out_buf_size] = '\0';
+    if (to_stdout)
+        putchar(tx_shift);
+    tx_shift = -1;
+
+    LINSIR = 1 << LTXOK;
+    if (irq) {
+        LIN_TC_vect();
+        tx_take();
+    }
+}
+
+double host_uart_tx_wait_us(void)
+{
+    double now = host_now_us();
+
+    tx_take();
+    if (tx_shift < 0)
+        return -1;
+    return tx_done_us > now ? tx_done_us - now : 0;
+}
+
+void host_uart_tx_done(void)
+{
+    tx_take();
+    if (tx_shift >= 0)
+        tx_complete(true);
+}
+
+/* Waiting for the Tx interrupt (with interrupts enabled) to make room. */
+void host_uart_wait(void)
+{
+    double us = host_uart_tx_wait_us();
+
+    if (us >= 0) {
+        host_busy(us);
+        host_uart_tx_done();
+    }
+    if (rx_in_wait >= 0) {
+        u8 c = rx_in_wait;
+
+        rx_in_wait = -1;
+        host_uart_receive_byte(c);
+    }
+}
+
+/* Polling LTXOK (with interrupts disabled): the byte completes meanwhile. */
+void host_poll(volatile uint8_t *sfr)
+{
+    double us;
+
+    if (sfr != &LINSIR)
+        return;
+    us = host_uart_tx_wait_us();
+    if (us >= 0) {
+        host_busy(us);
+        tx_complete(false);
+    }
+}
+
+/* Send everything queued, without taking any time. */
+static void tx_flush(void)
+{
+    tx_take();
+    while (tx_shift >= 0)
+        tx_complete(true);
+}
+
+void host_uart_receive_byte(u8 c)
+{
+    /* Like the controller, the byte on the wire is not in LINDAT. */
+    tx_take();
+    if (PRR & (1 << PRLIN) || !(LINENIR & (1 << LENRXOK)))
+        return;
+    LINDAT = c;
+    LINSIR = 1 << LRXOK;
+    if (rx_overrun) {
+        LINSIR |= 1 << LERR;
+        LINERR = 1 << LOVERR;
+        rx_overrun = false;
+    }
+    LIN_TC_vect();
+    LINERR = 0;
+    tx_take();
+}
+
+/*
+ * Lose the next byte as if its interrupt came too late: the controller
+ * flags an overrun along with the byte after it.
+ */
+void host_uart_rx_overrun(void)
+{
+    rx_overrun = true;
+}
+
+/*
+ * Receive c during the next wait for room in the Tx buffer, right after the Tx
+ * interrupt: its echo then competes with the waiting sender for that room.
+ */
+void host_uart_receive_in_wait(u8 c)
+{
+    rx_in_wait = c;
+}
+
+void host_uart_receive_raw(const u8 *buf, size_t len)
+{
+    while (len--)
+        host_uart_receive_byte(*buf++);
+}
+
+void host_uart_receive(const char *line)
+{
+    while (*line)
+        host_uart_receive_byte(*line++);
+    host_uart_receive_byte('\n');
+}
+
+const char *host_uart_output(void)
+{
+    tx_flush();
+    return out_buf;
+}
+
+size_t host_uart_output_size(void)
+{
+    tx_flush();
+    return out_buf_size;
+}
+
+void host_uart_clear(void)
+{
+    tx_flush();
+    out_buf_size = 0;
+    out_buf[0] = '\0';
+}
+
+void host_uart_set_stdout(bool on)
+{
+    to_stdout = on;
+}
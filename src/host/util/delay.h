@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for <util/delay.h>. Delays do not block; instead the time the
+ * MCU would have spent busy-waiting is accumulated in host_delay_us (and the
+ * current consumption model, see host_busy()).
+ */
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+void host_busy(double us);
+
+#define _delay_us(us) host_busy(us)
+#define _delay_ms(ms) host_busy((ms) * 1000.0)
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Time base for isrstats.c: Timer0 free-running at clk/64, extended to 16 bits
+ * by its overflow interrupt.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+
+#include "isrstats.h"
+
+#if ISR_STATS
+
+static volatile u8 ticks_hi;
+
+void isrstats_timer_init(void)
+{
+    power_timer0_enable();
+    TCCR0A = 0;
+    TCNT0 = 0;
+    TIFR0 = 1<<TOV0;
+    TIMSK0 = 1<<TOIE0;
+    TCCR0B = 1<<CS02; /* clk/64 */
+}
+
+/* Also correct inside ISRs, where an overflow may be pending. */
+u16 isrstats_now(void)
+{
+    u8 sreg = SREG;
+    u8 hi, lo;
+
+    cli();
+    hi = ticks_hi;
+    lo = TCNT0;
+    if ((TIFR0 & (1<<TOV0)) && lo < 0x80)
+        hi++;
+    SREG = sreg;
+    return (u16)hi << 8 | lo;
+}
+
+ISR(TIMER0_OVF_vect)
+{
+    ticks_hi++;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "isrstats.h"
+
+#if ISR_STATS
+
+static struct isrstats_hist hists[ISRSTATS_NUM];
+static u16 posted_at[ISRSTATS_NUM_EVENTS];
+
+static void add(struct isrstats_hist *h, u16 ticks)
+{
+    u8 b = 0;
+
+    for (u16 limit = 1; ticks >= limit && b < ISRSTATS_BUCKETS - 1; limit <<= 2)
+        b++;
+    if (h->count[b] != 0xffff)
+        h->count[b]++;
+    if (ticks > h->max)
+        h->max = ticks;
+}
+
+/* Called at the end of an ISR, through ISRSTATS_EXIT(). */
+void isrstats_record(u8 hist, u16 start)
+{
+    add(&hists[hist], isrstats_now() - start);
+}
+
+/*
+ * Called from events_post() and events_take() (with interrupts disabled) with
+ * the events that were newly posted or taken.
+ */
+void isrstats_posted(u8 ev)
+{
+    u16 now = isrstats_now();
+
+    for (u8 i = 0; i < ISRSTATS_NUM_EVENTS; i++)
+        if (ev & (1 << i))
+            posted_at[i] = now;
+}
+
+void isrstats_taken(u8 ev)
+{
+    u16 now = isrstats_now();
+
+    for (u8 i = 0; i < ISRSTATS_NUM_EVENTS; i++)
+        if (ev & (1 << i))
+            add(&hists[ISRSTATS_NUM_ISRS + i], now - posted_at[i]);
+}
+
+void isrstats_get(u8 hist, struct isrstats_hist *ret)
+{
+    u8 sreg = SREG;
+
+    cli();
+    *ret = hists[hist];
+    SREG = sreg;
+}
+
+void isrstats_reset(void)
+{
+    u8 sreg = SREG;
+
+    cli();
+    memset(hists, 0, sizeof(hists));
+    SREG = sreg;
+}
+
+#endif
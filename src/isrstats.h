@@ -0,0 +1,66 @@
+#ifndef ISRSTATS_H
+#define ISRSTATS_H
+
+#include "types.h"
+#include "stack.h"
+#include "events.h"
+
+/*
+ * Histograms of how long every ISR runs (with interrupts disabled), and of how
+ * long each event waits from being posted until the main loop takes it.
+ *
+ * This is a debug option (make ISR_STATS=1): it needs about 130 bytes of RAM,
+ * keeps Timer0 running as the time base (so it cannot be combined with the
+ * twi-usi-async driver), and keeps the CPU at the fast clock so the time base
+ * does not change speed.
+ *
+ * Time is counted in ticks of Timer0 at clk/64, ISRSTATS_TICK_US each. Bucket
+ * 0 counts durations under one tick, every next bucket four times as long, and
+ * the last one everything longer.
+ */
+#ifndef ISR_STATS
+# define ISR_STATS 0
+#endif
+
+#define ISRSTATS_TICK_US (64 / (F_CPU / 1000000UL))
+#define ISRSTATS_BUCKETS 8
+
+/* Histograms: one per ISR (enum stack_isr), then one per event. */
+#define ISRSTATS_NUM_ISRS STACK_ISR_TIMER0 /* Timer0 is the time base */
+#define ISRSTATS_NUM_EVENTS 3
+#define ISRSTATS_NUM (ISRSTATS_NUM_ISRS + ISRSTATS_NUM_EVENTS)
+
+struct isrstats_hist {
+    u16 max;    /* Longest, in ticks */
+    u16 count[ISRSTATS_BUCKETS];
+};
+
+#if ISR_STATS
+
+/* Put ISRSTATS_ENTER() first in an ISR and ISRSTATS_EXIT() last. */
+# define ISRSTATS_ENTER() u16 ___isr_start = isrstats_now()
+# define ISRSTATS_EXIT(isr) isrstats_record(isr, ___isr_start)
+
+/* The time base, isrstats-timer0.c on the AVR. */
+void isrstats_timer_init(void);
+u16 isrstats_now(void);
+
+void isrstats_record(u8 hist, u16 start);
+void isrstats_posted(u8 ev);
+void isrstats_taken(u8 ev);
+void isrstats_get(u8 hist, struct isrstats_hist *ret);
+void isrstats_reset(void);
+
+#else
+
+# define ISRSTATS_ENTER() do { } while (0)
+# define ISRSTATS_EXIT(isr) do { } while (0)
+
+static inline void isrstats_timer_init(void) { }
+static inline void isrstats_posted(u8 ev) { (void)ev; }
+static inline void isrstats_taken(u8 ev) { (void)ev; }
+static inline void isrstats_reset(void) { }
+
+#endif
+
+#endif
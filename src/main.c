@@ -5,8 +5,6 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
-#include <avr/sleep.h>
-#include <avr/eeprom.h>
 
 #include "types.h"
 #include "datetime.h"
@@ -15,24 +13,24 @@
 #include "twi.h"
 #include "rtc.h"
 #include "display.h"
+#include "events.h"
+#include "clock.h"
+#include "power.h"
+#include "sysclk.h"
+#include "settings.h"
+#include "proto.h"
+#include "stack.h"
+#include "isrstats.h"
 
 /* Set by makefile based on git version. */
 #ifndef VERSION
 # define VERSION "undef"
 #endif
 
-static u8 display_brightness_ee EEMEM = 1; /* 0..7 */
-static u8 display_brightness;
-
-static u8 datediff_enabled_ee EEMEM = 0;
-static u8 datediff_enabled;
-
-static struct datetime datediff_target_ee EEMEM = {
-    .date = { .day = 1, .month = 1, .year = 2019 },
-    .time = { .hour = 0, .min = 0, .sec = 0 },
-};
-static struct datetime datediff_target;
+static void proto_init(void);
 
+/* Baud rate requested in a binary frame, switched to after the response. */
+static u32 frame_baud;
 
 void init(void)
 {
@@ -41,97 +39,254 @@ void init(void)
     PORTA = 0;
     PORTB = 0;
 
+    sysclk_fast();
+    power_init();
+    isrstats_timer_init();
+
     pin_set_mode(PIN_LED1, OUTPUT);
     pin_set_mode(PIN_LED2, OUTPUT);
 
     pin_set_mode(PIN_RTC_INT, INPUT);
 
-    EICRA = 1<<ISC11 | 0 << ISC10; /* INT1 falling edge */
+    /* INT1 low level: unlike edges, this also wakes us from power-down. */
+    EICRA = 0<<ISC11 | 0<<ISC10;
     EIMSK = 1<<INT1; /* Enable external INT1 */
 
-    display_brightness = eeprom_read_byte(&display_brightness_ee);
-
-    datediff_enabled = eeprom_read_byte(&datediff_enabled_ee);
-    eeprom_read_block(&datediff_target, &datediff_target_ee,
-            sizeof(datediff_target));
-
+    settings_load();
+    clock_set_soft(settings.soft_clock);
+    proto_init();
 }
 
-void update_display(void)
+void show_datetime(struct datetime *now)
 {
-    if (datediff_enabled) {
+    if (settings.datediff_enabled) {
         u16 days;
-        struct date date;
-        rtc_read_date(&date);
-        days = date_diff_days(&datediff_target.date, &date);
-        display_shownum(days, false, false, display_brightness);
+        days = date_diff_days(&settings.datediff_target.date, &now->date);
+        display_shownum(days, false, false, settings.display_brightness);
     } else {
-        struct time time;
-        rtc_read_time(&time);
-        display_shownum(time.hour * 100 + time.min, true, true, display_brightness);
+        display_shownum(now->time.hour * 100 + now->time.min, true, true,
+                settings.display_brightness);
+    }
+}
+
+/* Only reads the half of the date/time that is actually shown. */
+void update_display(void)
+{
+    struct datetime now;
+
+    if (settings.datediff_enabled)
+        clock_read_date(&now.date);
+    else
+        clock_read_time(&now.time);
+    show_datetime(&now);
+}
+
+/* Write the time to the RTC and read back the date and time now set. */
+static void set_time(struct time *time, struct datetime *now)
+{
+    rtc_write_time(time);
+    rtc_read_datetime(now, NULL, NULL);
+    clock_invalidate();
+    show_datetime(now);
+}
+
+static void set_date(struct date *date, struct datetime *now)
+{
+    rtc_write_date(date);
+    rtc_read_datetime(now, NULL, NULL);
+    clock_invalidate();
+    show_datetime(now);
+}
+
+static void set_datetime(struct datetime *datetime, struct datetime *now)
+{
+    rtc_write_datetime(datetime);
+    rtc_read_datetime(now, NULL, NULL);
+    clock_invalidate();
+    show_datetime(now);
+}
+
+static void set_datediff_enabled(bool enabled)
+{
+    settings.datediff_enabled = enabled;
+    settings_changed();
+    update_display();
+}
+
+static void set_brightness(u8 brightness)
+{
+    settings.display_brightness = brightness & 0x7;
+    settings_changed();
+    update_display();
+}
+
+static void set_soft_clock(bool enabled)
+{
+    clock_set_soft(enabled);
+    settings.soft_clock = enabled;
+    settings_changed();
+}
+
+#if ISR_STATS
+static const char isrstats_names[ISRSTATS_NUM][7] PROGMEM = {
+    "int1", "timer1", "lin", "pcint0", "minute", "uartrx", "frame",
+};
+
+static void print_isrstats(void)
+{
+    struct isrstats_hist h;
+    char name[7];
+
+    LOGF("Stats tick %u us, buckets x4", (unsigned)ISRSTATS_TICK_US);
+    for (u8 i = 0; i < ISRSTATS_NUM; i++) {
+        isrstats_get(i, &h);
+        strcpy_P(name, isrstats_names[i]);
+        LOGF("%s max %u: %u %u %u %u %u %u %u %u", name, h.max, h.count[0],
+                h.count[1], h.count[2], h.count[3], h.count[4], h.count[5],
+                h.count[6], h.count[7]);
     }
 }
+#endif
 
 void handle_command(char *msg)
 {
     struct time time;
     struct date date;
+    struct datetime now, dt;
     struct rtc_temp temp;
-
-    _delay_ms(10);
+    struct uart_stats stats;
+    struct clock_stats clk;
+    struct power_stats pwr;
+    struct settings_stats sets;
+    struct stack_stats ram;
 
     if (!strcmp(msg, "tg")) {
         rtc_read_time(&time);
         time_print(&time);
     } else if (!strncmp(msg, "ts ", 3)) {
         time_from_string(&msg[3], &time);
-        rtc_write_time(&time);
-        rtc_read_time(&time);
-        time_print(&time);
-        update_display();
+        set_time(&time, &now);
+        time_print(&now.time);
 
     } else if (!strcmp(msg, "dg")) {
-        rtc_read_date(&date);
+        clock_read_date(&date);
         date_print(&date);
     } else if (!strncmp(msg, "ds ", 3)) {
         date_from_string(&msg[3], &date);
-        rtc_write_date(&date);
-        rtc_read_date(&date);
-        date_print(&date);
-        update_display();
+        set_date(&date, &now);
+        date_print(&now.date);
+    } else if (!strcmp(msg, "dtg")) {
+        rtc_read_datetime(&now, NULL, NULL);
+        datetime_print(&now);
+    } else if (!strncmp(msg, "dts ", 4)) {
+        datetime_from_string(&msg[4], &dt);
+        set_datetime(&dt, &now);
+        datetime_print(&now);
 
     } else if (!strcmp(msg, "ddg")) {
-        datetime_print(&datediff_target);
+        datetime_print(&settings.datediff_target);
     } else if (!strncmp(msg, "dds ", 4)) {
-        datetime_from_string(&msg[4], &datediff_target);
-        datetime_print(&datediff_target);
+        datetime_from_string(&msg[4], &settings.datediff_target);
+        datetime_print(&settings.datediff_target);
         update_display();
-        datetime_print(&datediff_target);
-        eeprom_write_block(&datediff_target, &datediff_target_ee,
-                sizeof(datediff_target));
+        datetime_print(&settings.datediff_target);
+        settings_changed();
     } else if (!strcmp(msg, "dde 0")) {
         LOG("Datediff disabled");
-        datediff_enabled = 0;
-        eeprom_write_byte(&datediff_enabled_ee, datediff_enabled);
-        update_display();
+        set_datediff_enabled(false);
     } else if (!strcmp(msg, "dde 1")) {
         LOG("Datediff enabled");
-        datediff_enabled = 1;
-        eeprom_write_byte(&datediff_enabled_ee, datediff_enabled);
-        update_display();
+        set_datediff_enabled(true);
 
     } else if (!strcmp(msg, "bg")) {
-        LOGF("Brightness %u/7", display_brightness);
+        LOGF("Brightness %u/7", settings.display_brightness);
     } else if (!strncmp(msg, "bs ", 3)) {
-        display_brightness = atoi(&msg[3]) & 0x7;
-        eeprom_write_byte(&display_brightness_ee, display_brightness);
+        set_brightness(atoi(&msg[3]));
+        LOGF("Brightness %u/7", settings.display_brightness);
+
+    } else if (!strcmp(msg, "ag")) {
+        LOGF("Aging %d", rtc_read_aging());
+    } else if (!strncmp(msg, "as ", 3)) {
+        rtc_write_aging(atoi(&msg[3]));
+        LOGF("Aging %d", rtc_read_aging());
+
+    } else if (!strcmp(msg, "show")) {
         update_display();
-        LOGF("Brightness %u/7", display_brightness);
+        LOG("Showing clock");
+    } else if (!strncmp(msg, "show ", 5)) {
+        display_showtext(&msg[5], settings.display_brightness);
+        LOGF("Showing \"%s\"", &msg[5]);
 
     } else if (!strcmp(msg, "temp")) {
         rtc_read_temp(&temp);
         LOGF("Temp %d.%u C", temp.temp, temp.fraction);
 
+    } else if (!strcmp(msg, "clk")) {
+        clock_get_stats(&clk);
+        LOGF("Clock %s resyncs %u drift %d s max %d s",
+                clock_is_soft() ? "soft" : "rtc", clk.resyncs, clk.last_drift,
+                clk.max_drift);
+    } else if (!strcmp(msg, "clk 0")) {
+        LOG("Soft clock disabled");
+        set_soft_clock(false);
+    } else if (!strcmp(msg, "clk 1")) {
+        LOG("Soft clock enabled");
+        set_soft_clock(true);
+
+    } else if (!strcmp(msg, "save")) {
+        settings_flush();
+        settings_get_stats(&sets);
+        LOGF("Settings slot %u seq %u writes %u", sets.slot, sets.seq,
+                sets.writes);
+
+    } else if (!strcmp(msg, "pwr")) {
+        power_get_stats(&pwr);
+        LOGF("Power idle %u pdown %u uartwake %u", pwr.idle, pwr.power_down,
+                pwr.uart_wakeups);
+
+    } else if (!strcmp(msg, "ram")) {
+        stack_get_stats(&ram);
+        LOGF("RAM data %u stack max %u unused %u free %u", ram.data,
+                ram.stack_max, ram.unused, ram.free);
+        LOGF("ISR depth int1 %u timer1 %u lin %u pcint0 %u timer0 %u",
+                ram.isr_depth[STACK_ISR_INT1], ram.isr_depth[STACK_ISR_TIMER1],
+                ram.isr_depth[STACK_ISR_LIN], ram.isr_depth[STACK_ISR_PCINT0],
+                ram.isr_depth[STACK_ISR_TIMER0]);
+
+    } else if (!strcmp(msg, "stats")) {
+#if ISR_STATS
+        print_isrstats();
+#else
+        LOG("ISR stats not built in");
+#endif
+    } else if (!strcmp(msg, "stats reset")) {
+        isrstats_reset();
+        LOG("Stats reset");
+
+    } else if (!strcmp(msg, "uart")) {
+        uart_get_stats(&stats);
+        LOGF("UART overrun %u overflow %u dropped %u txdrop %u",
+                stats.rx_overrun, stats.rx_overflow, stats.rx_dropped,
+                stats.tx_dropped);
+    } else if (!strcmp(msg, "echo 0")) {
+        uart_set_echo(false);
+    } else if (!strcmp(msg, "echo 1")) {
+        uart_set_echo(true);
+    } else if (!strcmp(msg, "baud")) {
+        LOGF("Baud %lu", (unsigned long)uart_get_baud());
+    } else if (!strncmp(msg, "baud ", 5)) {
+        u32 baud = atol(&msg[5]);
+
+        if (uart_baud_supported(baud)) {
+            LOGF("Baud %lu", (unsigned long)baud);
+            uart_set_baud(baud);
+        } else {
+            LOGF("Unsupported baud %lu", (unsigned long)baud);
+        }
+    } else if (!strcmp(msg, "bin")) {
+        LOG("Binary mode");
+        proto_enable();
+
     } else if (!strncmp(msg, "ver", 3)) {
         LOGF("Version %s", VERSION);
 
@@ -140,6 +295,397 @@ void handle_command(char *msg)
     }
 }
 
+/*
+ * Requests of the binary protocol (proto.h), mostly the same as the text
+ * commands above.
+ */
+static void put_u16(u8 *p, u16 val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+}
+
+static void put_time(u8 *p, const struct time *time)
+{
+    p[0] = time->hour;
+    p[1] = time->min;
+    p[2] = time->sec;
+}
+
+static void put_date(u8 *p, const struct date *date)
+{
+    p[0] = date->day;
+    p[1] = date->month;
+    put_u16(&p[2], date->year);
+}
+
+static bool get_time(const u8 *p, struct time *ret)
+{
+    ret->hour = p[0];
+    ret->min = p[1];
+    ret->sec = p[2];
+    return ret->hour < 24 && ret->min < 60 && ret->sec < 60;
+}
+
+static bool get_date(const u8 *p, struct date *ret)
+{
+    ret->day = p[0];
+    ret->month = p[1];
+    ret->year = p[2] | p[3] << 8;
+    return ret->year >= 1900 && ret->year <= 2099 &&
+           ret->month >= 1 && ret->month <= 12 &&
+           ret->day >= 1 &&
+           ret->day <= date_days_per_month(ret->month, ret->year);
+}
+
+static u8 op_version(const u8 *arg, u8 *res)
+{
+    (void)arg;
+    strncpy((char *)res, VERSION, 16);
+    return PROTO_OK;
+}
+
+static u8 op_time_get(const u8 *arg, u8 *res)
+{
+    struct time time;
+
+    (void)arg;
+    rtc_read_time(&time);
+    put_time(res, &time);
+    return PROTO_OK;
+}
+
+static u8 op_time_set(const u8 *arg, u8 *res)
+{
+    struct time time;
+    struct datetime now;
+
+    if (!get_time(arg, &time))
+        return PROTO_ERR_ARG;
+    set_time(&time, &now);
+    put_time(res, &now.time);
+    return PROTO_OK;
+}
+
+static u8 op_date_get(const u8 *arg, u8 *res)
+{
+    struct date date;
+
+    (void)arg;
+    clock_read_date(&date);
+    put_date(res, &date);
+    return PROTO_OK;
+}
+
+static u8 op_date_set(const u8 *arg, u8 *res)
+{
+    struct date date;
+    struct datetime now;
+
+    if (!get_date(arg, &date))
+        return PROTO_ERR_ARG;
+    set_date(&date, &now);
+    put_date(res, &now.date);
+    return PROTO_OK;
+}
+
+static u8 op_datetime_get(const u8 *arg, u8 *res)
+{
+    struct datetime now;
+
+    (void)arg;
+    rtc_read_datetime(&now, NULL, NULL);
+    put_date(res, &now.date);
+    put_time(&res[4], &now.time);
+    return PROTO_OK;
+}
+
+/* Done as soon as the frame is received, so that is when the second starts. */
+static u8 op_datetime_set(const u8 *arg, u8 *res)
+{
+    struct datetime dt, now;
+
+    if (!get_date(arg, &dt.date) || !get_time(&arg[4], &dt.time))
+        return PROTO_ERR_ARG;
+    set_datetime(&dt, &now);
+    put_date(res, &now.date);
+    put_time(&res[4], &now.time);
+    return PROTO_OK;
+}
+
+/* Request and response are as long as for PROTO_OP_DATETIME_SET. */
+static u8 op_ping(const u8 *arg, u8 *res)
+{
+    memcpy(res, arg, 7);
+    return PROTO_OK;
+}
+
+static u8 op_datediff_get(const u8 *arg, u8 *res)
+{
+    (void)arg;
+    put_date(res, &settings.datediff_target.date);
+    put_time(&res[4], &settings.datediff_target.time);
+    return PROTO_OK;
+}
+
+static u8 op_datediff_set(const u8 *arg, u8 *res)
+{
+    struct datetime target;
+
+    if (!get_date(arg, &target.date) || !get_time(&arg[4], &target.time))
+        return PROTO_ERR_ARG;
+    settings.datediff_target = target;
+    settings_changed();
+    update_display();
+    return op_datediff_get(arg, res);
+}
+
+static u8 op_datediff_enable(const u8 *arg, u8 *res)
+{
+    if (arg[0] > 1)
+        return PROTO_ERR_ARG;
+    set_datediff_enabled(arg[0]);
+    res[0] = settings.datediff_enabled;
+    return PROTO_OK;
+}
+
+static u8 op_brightness_get(const u8 *arg, u8 *res)
+{
+    (void)arg;
+    res[0] = settings.display_brightness;
+    return PROTO_OK;
+}
+
+static u8 op_brightness_set(const u8 *arg, u8 *res)
+{
+    if (arg[0] > 7)
+        return PROTO_ERR_ARG;
+    set_brightness(arg[0]);
+    res[0] = settings.display_brightness;
+    return PROTO_OK;
+}
+
+static u8 op_temp_get(const u8 *arg, u8 *res)
+{
+    struct rtc_temp temp;
+
+    (void)arg;
+    rtc_read_temp(&temp);
+    res[0] = temp.temp;
+    res[1] = temp.fraction;
+    return PROTO_OK;
+}
+
+static u8 op_aging_get(const u8 *arg, u8 *res)
+{
+    (void)arg;
+    res[0] = rtc_read_aging();
+    return PROTO_OK;
+}
+
+static u8 op_aging_set(const u8 *arg, u8 *res)
+{
+    rtc_write_aging(arg[0]);
+    return op_aging_get(arg, res);
+}
+
+/* Shown until the display is next updated, at the next minute at the latest. */
+static u8 op_show_text(const u8 *arg, u8 *res)
+{
+    char text[DISPLAY_TEXT_MAX + 1];
+
+    (void)res;
+    memcpy(text, arg, DISPLAY_TEXT_MAX);
+    text[DISPLAY_TEXT_MAX] = '\0';
+    if (text[0])
+        display_showtext(text, settings.display_brightness);
+    else
+        update_display();
+    return PROTO_OK;
+}
+
+static u8 op_soft_clock(const u8 *arg, u8 *res)
+{
+    if (arg[0] > 1)
+        return PROTO_ERR_ARG;
+    set_soft_clock(arg[0]);
+    res[0] = clock_is_soft();
+    return PROTO_OK;
+}
+
+static u8 op_clock_stats(const u8 *arg, u8 *res)
+{
+    struct clock_stats clk;
+
+    (void)arg;
+    clock_get_stats(&clk);
+    res[0] = clock_is_soft();
+    put_u16(&res[1], clk.resyncs);
+    put_u16(&res[3], clk.last_drift);
+    put_u16(&res[5], clk.max_drift);
+    return PROTO_OK;
+}
+
+static u8 op_uart_stats(const u8 *arg, u8 *res)
+{
+    struct uart_stats stats;
+
+    (void)arg;
+    uart_get_stats(&stats);
+    put_u16(&res[0], stats.rx_overrun);
+    put_u16(&res[2], stats.rx_overflow);
+    put_u16(&res[4], stats.rx_dropped);
+    put_u16(&res[6], stats.tx_dropped);
+    return PROTO_OK;
+}
+
+static u8 op_power_stats(const u8 *arg, u8 *res)
+{
+    struct power_stats pwr;
+
+    (void)arg;
+    power_get_stats(&pwr);
+    put_u16(&res[0], pwr.idle);
+    put_u16(&res[2], pwr.power_down);
+    put_u16(&res[4], pwr.uart_wakeups);
+    return PROTO_OK;
+}
+
+static u8 op_save(const u8 *arg, u8 *res)
+{
+    struct settings_stats sets;
+
+    (void)arg;
+    settings_flush();
+    settings_get_stats(&sets);
+    res[0] = sets.slot;
+    res[1] = sets.seq;
+    put_u16(&res[2], sets.writes);
+    return PROTO_OK;
+}
+
+static u8 op_baud(const u8 *arg, u8 *res)
+{
+    u32 baud = arg[0] | (u32)arg[1] << 8 | (u32)arg[2] << 16 |
+               (u32)arg[3] << 24;
+
+    if (!uart_baud_supported(baud))
+        return PROTO_ERR_ARG;
+    frame_baud = baud;
+    memcpy(res, arg, 4);
+    return PROTO_OK;
+}
+
+static u8 op_ram_stats(const u8 *arg, u8 *res)
+{
+    struct stack_stats ram;
+
+    (void)arg;
+    stack_get_stats(&ram);
+    put_u16(&res[0], ram.data);
+    put_u16(&res[2], ram.stack_max);
+    put_u16(&res[4], ram.unused);
+    put_u16(&res[6], ram.free);
+    for (u8 i = 0; i < STACK_NUM_ISRS; i++)
+        put_u16(&res[8 + 2 * i], ram.isr_depth[i]);
+    return PROTO_OK;
+}
+
+#if ISR_STATS
+static u8 op_isr_stats(const u8 *arg, u8 *res)
+{
+    struct isrstats_hist h;
+
+    if (arg[0] >= ISRSTATS_NUM)
+        return PROTO_ERR_ARG;
+    isrstats_get(arg[0], &h);
+    res[0] = ISRSTATS_TICK_US;
+    put_u16(&res[1], h.max);
+    for (u8 i = 0; i < ISRSTATS_BUCKETS; i++)
+        put_u16(&res[3 + 2 * i], h.count[i]);
+    return PROTO_OK;
+}
+
+static u8 op_isr_stats_reset(const u8 *arg, u8 *res)
+{
+    (void)arg;
+    (void)res;
+    isrstats_reset();
+    return PROTO_OK;
+}
+#endif
+
+/* The switch itself is done by proto_process() after the response. */
+static u8 op_text(const u8 *arg, u8 *res)
+{
+    (void)arg;
+    (void)res;
+    return PROTO_OK;
+}
+
+static const struct proto_op proto_ops[] PROGMEM = {
+    { PROTO_OP_VERSION,         0, 16, op_version },
+    { PROTO_OP_TIME_GET,        0, 3, op_time_get },
+    { PROTO_OP_TIME_SET,        3, 3, op_time_set },
+    { PROTO_OP_DATE_GET,        0, 4, op_date_get },
+    { PROTO_OP_DATE_SET,        4, 4, op_date_set },
+    { PROTO_OP_DATETIME_GET,    0, 7, op_datetime_get },
+    { PROTO_OP_DATEDIFF_GET,    0, 7, op_datediff_get },
+    { PROTO_OP_DATEDIFF_SET,    7, 7, op_datediff_set },
+    { PROTO_OP_DATEDIFF_ENABLE, 1, 1, op_datediff_enable },
+    { PROTO_OP_BRIGHTNESS_GET,  0, 1, op_brightness_get },
+    { PROTO_OP_BRIGHTNESS_SET,  1, 1, op_brightness_set },
+    { PROTO_OP_TEMP_GET,        0, 2, op_temp_get },
+    { PROTO_OP_SOFT_CLOCK,      1, 1, op_soft_clock },
+    { PROTO_OP_CLOCK_STATS,     0, 7, op_clock_stats },
+    { PROTO_OP_UART_STATS,      0, 8, op_uart_stats },
+    { PROTO_OP_POWER_STATS,     0, 6, op_power_stats },
+    { PROTO_OP_SAVE,            0, 4, op_save },
+    { PROTO_OP_TEXT,            0, 0, op_text },
+    { PROTO_OP_BAUD,            4, 4, op_baud },
+    { PROTO_OP_RAM_STATS,       0, 8 + 2 * STACK_NUM_ISRS, op_ram_stats },
+    { PROTO_OP_DATETIME_SET,    7, 7, op_datetime_set },
+    { PROTO_OP_PING,            7, 7, op_ping },
+    { PROTO_OP_AGING_GET,       0, 1, op_aging_get },
+    { PROTO_OP_AGING_SET,       1, 1, op_aging_set },
+    { PROTO_OP_SHOW_TEXT,       DISPLAY_TEXT_MAX, 0, op_show_text },
+#if ISR_STATS
+    { PROTO_OP_ISR_STATS,       1, 3 + 2 * ISRSTATS_BUCKETS, op_isr_stats },
+    { PROTO_OP_ISR_STATS_RESET, 0, 0, op_isr_stats_reset },
+#endif
+};
+
+static void proto_init(void)
+{
+    proto_set_ops(proto_ops, sizeof(proto_ops) / sizeof(proto_ops[0]));
+}
+
+void process_events(void)
+{
+    u8 ev = events_take();
+
+    if (ev & EV_MINUTE) {
+        rtc_notifier_handled();
+        EIMSK |= 1<<INT1; /* INT is released now */
+        power_minute_tick();
+        clock_minute_tick();
+        settings_flush();
+        update_display();
+    }
+    if (ev & EV_UART_RX) {
+        power_uart_activity();
+        uart_process();
+    }
+    if (ev & EV_FRAME) {
+        power_uart_activity();
+        proto_process();
+        if (frame_baud) {
+            uart_set_baud(frame_baud);
+            frame_baud = 0;
+        }
+    }
+}
+
 int main(void)
 {
     init();
@@ -150,22 +696,26 @@ int main(void)
     rtc_enable_notifier();
     display_init();
 
+    /* The display is updated from interrupts, and ISRs only post events. */
+    sei();
+
     LOG("*** Simpleclock initialized");
     _delay_ms(1000);
     update_display();
 
-    sei();
-
     while (1) {
-        _delay_ms(10);
-        sleep_mode();
+        events_wait();
+        process_events();
     }
 }
 
+/* The RTC keeps INT low until the alarm is handled, so mask it until then. */
 ISR(INT1_vect)
 {
-    cli();
-    rtc_notifier_handled();
-    update_display();
-    sei();
+    ISRSTATS_ENTER();
+    STACK_ISR(STACK_ISR_INT1);
+
+    EIMSK &= ~(1<<INT1);
+    events_post(EV_MINUTE);
+    ISRSTATS_EXIT(STACK_ISR_INT1);
 }
@@ -5,8 +5,6 @@
 #ifndef PINS_H
 #define PINS_H
 
-#include <stdlib.h>
-
 #include <avr/io.h>
 
 #include "types.h"
@@ -36,105 +34,80 @@
 #define OUTPUT 1
 
 /*
- * Pins that we can do I/O on.
- */
-static inline u8 pin_valid(u8 pin)
-{
-    if (pin == 0 || pin > 20)
-        return 0;
-    /* VCC/GND and AVCC/AGND */
-    if (pin == 5 || pin == 6 || pin == 15 || pin == 16)
-        return 0;
-    return 1;
-}
-
-/*
- * Map a pin (1..20) to the bit number for its registers (e.g., DDRA or PORTB).
+ * Port and bit of every pin we can do I/O on, by pin number (not VCC/GND and
+ * AVCC/AGND). Everything below resolves to these at compile time, so each
+ * access is a single sbi/cbi (or sbis/sbic in a condition) on a fixed I/O
+ * register. Using any other pin fails to compile, with an undeclared
+ * identifier like DDRPINS_5_PORT.
  */
-static inline u8 pin_to_bit(u8 pin)
-{
-    if (!pin_valid(pin))
-        return 8;
-    else if (pin <= 4)
-        return pin - 1;
-    else if (pin <= 10)
-        return pin - 3; /* skip AVCC/AGND */
-    else if (pin <= 14)
-        return 18 - pin; /* skip VCC/GND */
-    else
-        return 20 - pin;
-}
+#define PINS_1_PORT A
+#define PINS_1_BIT 0
+#define PINS_2_PORT A
+#define PINS_2_BIT 1
+#define PINS_3_PORT A
+#define PINS_3_BIT 2
+#define PINS_4_PORT A
+#define PINS_4_BIT 3
+#define PINS_7_PORT A
+#define PINS_7_BIT 4
+#define PINS_8_PORT A
+#define PINS_8_BIT 5
+#define PINS_9_PORT A
+#define PINS_9_BIT 6
+#define PINS_10_PORT A
+#define PINS_10_BIT 7
+#define PINS_11_PORT B
+#define PINS_11_BIT 7
+#define PINS_12_PORT B
+#define PINS_12_BIT 6
+#define PINS_13_PORT B
+#define PINS_13_BIT 5
+#define PINS_14_PORT B
+#define PINS_14_BIT 4
+#define PINS_17_PORT B
+#define PINS_17_BIT 3
+#define PINS_18_PORT B
+#define PINS_18_BIT 2
+#define PINS_19_PORT B
+#define PINS_19_BIT 1
+#define PINS_20_PORT B
+#define PINS_20_BIT 0
+
+/* The extra level of expansion turns PIN_* names into their numbers first. */
+#define PINS_PORT_(pin) PINS_ ## pin ## _PORT
+#define PINS_PORT(pin) PINS_PORT_(pin)
+#define PINS_BIT_(pin) PINS_ ## pin ## _BIT
+#define PINS_BIT(pin) PINS_BIT_(pin)
+#define PINS_REG_(reg, port) reg ## port
+#define PINS_REG(reg, port) PINS_REG_(reg, port)
+
+/* Data direction, output and input register of a pin (e.g., DDRA, PORTB). */
+#define PINS_DDR(pin) PINS_REG(DDR, PINS_PORT(pin))
+#define PINS_OUT(pin) PINS_REG(PORT, PINS_PORT(pin))
+#define PINS_IN(pin) PINS_REG(PIN, PINS_PORT(pin))
 
 /*
  * Bitmask for a given pin (1..20) for its corresponding registers.
  */
-static inline u8 pin_to_mask(u8 pin)
-{
-    return 1 << pin_to_bit(pin);
-}
-
-static inline volatile u8 *pin_to_control_reg(u8 pin)
-{
-    if (pin <= 10)
-        return &DDRA;
-    if (pin <= 20)
-        return &DDRB;
-    return NULL;
-}
-static inline volatile u8 *pin_to_output_reg(u8 pin)
-{
-    if (pin <= 10)
-        return &PORTA;
-    if (pin <= 20)
-        return &PORTB;
-    return NULL;
-}
-static inline volatile u8 *pin_to_input_reg(u8 pin)
-{
-    if (pin <= 10)
-        return &PINA;
-    if (pin <= 20)
-        return &PINB;
-    return NULL;
-}
-
-static inline void pin_set_mode(u8 pin, u8 mode)
-{
-    volatile u8 *reg = pin_to_control_reg(pin);
-    u8 mask = pin_to_mask(pin);
-
-    if (!pin_valid(pin))
-        return;
-
-    if (mode == INPUT)
-        *reg &= ~mask;
-    else
-        *reg |= mask;
-}
-
-static inline void pin_write(u8 pin, u8 val)
-{
-    volatile u8 *reg = pin_to_output_reg(pin);
-    u8 mask = pin_to_mask(pin);
-
-    if (!pin_valid(pin))
-        return;
-
-    if (val)
-        *reg |= mask;
-    else
-        *reg &= ~mask;
-}
-
-static inline u8 pin_read(u8 pin)
-{
-    volatile u8 *reg = pin_to_output_reg(pin);
-    u8 mask = pin_to_mask(pin);
-
-    if (!pin_valid(pin))
-        return 0;
-
-    return (*reg & mask) ? 1 : 0;
-}
+#define pin_to_mask(pin) ((u8)(1 << PINS_BIT(pin)))
+
+#define pin_set_mode(pin, mode) \
+    do { \
+        if (mode) \
+            PINS_DDR(pin) |= pin_to_mask(pin); \
+        else \
+            PINS_DDR(pin) &= ~pin_to_mask(pin); \
+    } while (0)
+
+#define pin_write(pin, val) \
+    do { \
+        if (val) \
+            PINS_OUT(pin) |= pin_to_mask(pin); \
+        else \
+            PINS_OUT(pin) &= ~pin_to_mask(pin); \
+    } while (0)
+
+/* The level on the pin, also when it is an output. */
+#define pin_read(pin) ((PINS_IN(pin) & pin_to_mask(pin)) ? 1 : 0)
 
 #endif
@@ -0,0 +1,115 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+
+#include "power.h"
+#include "pins.h"
+#include "uart.h"
+#include "twi.h"
+#include "display.h"
+#include "sysclk.h"
+#include "stack.h"
+#include "isrstats.h"
+
+static volatile u8 awake = POWER_AWAKE_MINUTES;
+static volatile struct power_stats stats;
+
+void power_init(void)
+{
+    power_adc_disable();
+    power_spi_disable();
+    power_timer0_disable();
+    power_timer1_disable();
+    power_usi_disable();
+
+    /* UART RX is PA0, PCINT0. The interrupt is only enabled in power-down. */
+    PCMSK0 = pin_to_mask(PIN_UART_RX);
+    PCICR = 0;
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+/*
+ * Sleep until the next interrupt. Called with interrupts disabled (see
+ * events_wait()), returns with them enabled.
+ */
+void power_sleep(void)
+{
+    bool quiet = !display_busy() && !twi_busy() && uart_tx_idle();
+    bool deep = quiet && !awake;
+    bool slow = !ISR_STATS && quiet && awake && !uart_busy() &&
+                uart_clock_ok(SYSCLK_OSC >> SYSCLK_SLOW_SHIFT);
+
+    if (deep) {
+        uart_suspend();
+        PCIFR = 1<<PCIF0;
+        PCICR = 1<<PCIE0;
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        stats.power_down++;
+    } else {
+        /* Only the UART is listening, which at 9600 baud works at the slow
+         * clock too. */
+        if (slow) {
+            sysclk_slow();
+            uart_clock_changed();
+        }
+        stats.idle++;
+    }
+
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    if (deep) {
+        cli();
+        PCICR = 0;
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        uart_resume();
+        sei();
+    }
+    if (slow) {
+        while (uart_busy())
+            ; /* Let the byte being received finish at this clock */
+        cli();
+        sysclk_fast();
+        uart_clock_changed();
+        sei();
+    }
+}
+
+/* Keep the UART listening for a while after it received something. */
+void power_uart_activity(void)
+{
+    awake = POWER_AWAKE_MINUTES;
+}
+
+void power_minute_tick(void)
+{
+    if (awake)
+        awake--;
+}
+
+void power_get_stats(struct power_stats *ret)
+{
+    u8 sreg = SREG;
+
+    cli();
+    ret->idle = stats.idle;
+    ret->power_down = stats.power_down;
+    ret->uart_wakeups = stats.uart_wakeups;
+    SREG = sreg;
+}
+
+/* Start bit on UART RX while in power-down. */
+ISR(PCINT0_vect)
+{
+    ISRSTATS_ENTER();
+    STACK_ISR(STACK_ISR_PCINT0);
+
+    PCICR = 0;
+    awake = POWER_AWAKE_MINUTES;
+    stats.uart_wakeups++;
+    ISRSTATS_EXIT(STACK_ISR_PCINT0);
+}
@@ -0,0 +1,36 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "types.h"
+
+/*
+ * Power management. Between events the MCU sleeps as deep as it can: idle
+ * while the display, TWI or UART transmitter is still busy, power-down
+ * otherwise. From power-down only INT1 (the RTC alarm) and a pin change on
+ * UART RX wake it up.
+ *
+ * The LIN/UART is off in power-down, so the byte that wakes the MCU is lost.
+ * After a received line (and after reset) the MCU stays in idle, listening, for
+ * POWER_AWAKE_MINUTES minute ticks. It runs at the slow clock (sysclk.h) then.
+ *
+ * Peripherals are only clocked while in use: power_init() turns them all off
+ * except the LIN/UART, and drivers turn theirs on and off (PRR) around their
+ * work with <avr/power.h>.
+ */
+#ifndef POWER_AWAKE_MINUTES
+# define POWER_AWAKE_MINUTES 2
+#endif
+
+struct power_stats {
+    u16 idle;           /* Sleeps in idle mode */
+    u16 power_down;     /* Sleeps in power-down mode */
+    u16 uart_wakeups;   /* Wakeups from power-down by UART RX */
+};
+
+void power_init(void);
+void power_sleep(void);
+void power_uart_activity(void);
+void power_minute_tick(void);
+void power_get_stats(struct power_stats *ret);
+
+#endif
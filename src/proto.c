@@ -0,0 +1,189 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+
+#include "proto.h"
+#include "uart.h"
+#include "events.h"
+
+enum rx_state {
+    RX_SYNC,
+    RX_LEN,
+    RX_DATA,
+    RX_CRC,
+    RX_DONE,    /* Complete frame waiting for proto_process() */
+};
+
+static volatile u8 rx_state = RX_SYNC;
+static u8 rx_buf[1 + PROTO_MAX_LEN + 1]; /* LEN, payload, CRC as received */
+static u8 rx_len;
+static u8 rx_pos;
+static u8 rx_crc;
+static bool rx_ok;
+
+static u8 tx_buf[PROTO_MAX_RESP];
+
+static const struct proto_op *ops; /* In PROGMEM */
+static u8 num_ops;
+
+/* Table of request handlers, in program memory. */
+void proto_set_ops(const struct proto_op *table, u8 num)
+{
+    ops = table;
+    num_ops = num;
+}
+
+/*
+ * Called from the UART Rx interrupt for every byte while in binary mode.
+ *
+ * When a byte of a frame is lost, the sync byte of the next one completes it
+ * with a bad CRC. So after a bad CRC, the bytes that came after the sync byte
+ * are gone through again, from the first sync byte among them on. Only if
+ * there is none, the frame gets the PROTO_ERR_CRC response.
+ */
+static void rx_byte(u8 c)
+{
+    u8 next = 0, end = 0; /* Bytes in rx_buf to go through again, after c */
+
+    for (;;) {
+        switch (rx_state) {
+        case RX_SYNC:
+            if (c == PROTO_SYNC)
+                rx_state = RX_LEN;
+            break;
+        case RX_LEN:
+            rx_buf[0] = rx_len = c;
+            rx_pos = 0;
+            rx_crc = _crc8_ccitt_update(0, c);
+            rx_state = c ? RX_DATA : RX_CRC;
+            break;
+        case RX_DATA:
+            if (rx_pos < PROTO_MAX_LEN)
+                rx_buf[1 + rx_pos] = c;
+            rx_crc = _crc8_ccitt_update(rx_crc, c);
+            if (++rx_pos == rx_len)
+                rx_state = RX_CRC;
+            break;
+        case RX_CRC:
+            rx_ok = c == rx_crc && rx_len <= PROTO_MAX_LEN;
+            if (!rx_ok && rx_len <= PROTO_MAX_LEN) {
+                /*
+                 * Everything after the sync byte in order: the frame, then
+                 * what was left to go through. Bytes only ever move down.
+                 */
+                u8 i = 1 + rx_len;
+
+                rx_buf[i++] = c;
+                memmove(&rx_buf[i], &rx_buf[next], end - next);
+                end = i + end - next;
+                for (i = 0; i < end && rx_buf[i] != PROTO_SYNC; i++)
+                    ;
+                if (i < end) {
+                    rx_state = RX_LEN;
+                    next = i + 1;
+                    break;
+                }
+            }
+            rx_state = RX_DONE;
+            events_post(EV_FRAME);
+            return;
+        default:
+            return;
+        }
+        if (next == end)
+            return;
+        c = rx_buf[next++];
+    }
+}
+
+void proto_enable(void)
+{
+    rx_state = RX_SYNC;
+    uart_set_raw_callback(rx_byte);
+}
+
+static bool find_op(u8 opcode, struct proto_op *ret)
+{
+    for (u8 i = 0; i < num_ops; i++) {
+        memcpy_P(ret, &ops[i], sizeof(*ret));
+        if (ret->opcode == opcode)
+            return true;
+    }
+    return false;
+}
+
+static void send_frame(const u8 *payload, u8 len)
+{
+    u8 crc = _crc8_ccitt_update(0, len);
+
+    uart_putchar(PROTO_SYNC);
+    uart_putchar(len);
+    for (u8 i = 0; i < len; i++) {
+        uart_putchar(payload[i]);
+        crc = _crc8_ccitt_update(crc, payload[i]);
+    }
+    uart_putchar(crc);
+}
+
+/* Handle the received frame, if any. Called from the main loop on EV_FRAME. */
+void proto_process(void)
+{
+    struct proto_op op;
+    const u8 *p = rx_buf + 1, *end = p + rx_len;
+    u8 *r = tx_buf, *r_end = tx_buf + sizeof(tx_buf);
+    bool text = false;
+
+    if (rx_state != RX_DONE)
+        return;
+
+    if (!rx_ok) {
+        *r++ = 0;
+        *r++ = PROTO_ERR_CRC;
+        end = p;
+    }
+
+    while (p < end) {
+        u8 opcode = *p++;
+
+        if (r_end - r < 2)
+            break;
+        *r++ = opcode;
+        if (!find_op(opcode, &op)) {
+            *r++ = PROTO_ERR_OPCODE;
+            break;
+        }
+        if (end - p < op.arg_len) {
+            *r++ = PROTO_ERR_LEN;
+            break;
+        }
+        if (r_end - r < 1 + op.res_len) {
+            *r++ = PROTO_ERR_FULL;
+            break;
+        }
+        *r = op.fn(p, r + 1);
+        if (*r++ == PROTO_OK)
+            r += op.res_len;
+        p += op.arg_len;
+        if (opcode == PROTO_OP_TEXT)
+            text = true;
+    }
+
+    /*
+     * The response is complete in tx_buf, so the next frame can already be
+     * received while it is sent. Not when going back to text mode after it.
+     */
+    if (!text) {
+        cli();
+        rx_state = RX_SYNC;
+        sei();
+    }
+
+    send_frame(tx_buf, r - tx_buf);
+
+    if (text) {
+        uart_set_raw_callback(NULL);
+        rx_state = RX_SYNC;
+    }
+}
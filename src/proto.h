@@ -0,0 +1,83 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include "types.h"
+
+/*
+ * Binary framed command protocol, an alternative to the text commands. The
+ * "bin" text command switches the UART to it, PROTO_OP_TEXT switches back.
+ *
+ * Frames in both directions are
+ *
+ *   PROTO_SYNC, LEN, LEN bytes of payload, CRC-8 (CCITT) over LEN and payload
+ *
+ * A request payload is a batch of requests: an opcode each, followed by its
+ * argument of a size fixed per opcode. The response payload has, for every
+ * request, the opcode, a status and (only if the status is PROTO_OK) the result,
+ * again of a fixed size. Processing stops at an unknown opcode or a truncated
+ * argument. A frame with a bad CRC (or too long) gets a response with the
+ * single entry 0, PROTO_ERR_CRC, unless a sync byte came after its own: then
+ * a byte was probably lost, and reception restarts from there without a
+ * response. Multi-byte values are little endian. Power-down sleep (see
+ * power.c) ends binary mode.
+ *
+ * Only one frame is handled at a time: bytes received before the previous
+ * frame has been handled are dropped. Once the first byte of its response has
+ * arrived, the next frame may be sent (overlapping the rest of the response).
+ */
+#define PROTO_SYNC 0xa5
+#define PROTO_MAX_LEN 32    /* Request payload */
+#define PROTO_MAX_RESP 64   /* Response payload */
+
+#define PROTO_OK            0
+#define PROTO_ERR_OPCODE    1
+#define PROTO_ERR_LEN       2
+#define PROTO_ERR_ARG       3
+#define PROTO_ERR_FULL      4   /* No room left in the response */
+#define PROTO_ERR_CRC       5
+
+/*                                     argument -> result */
+#define PROTO_OP_VERSION         0x01 /* - -> 16 chars, 0-padded */
+#define PROTO_OP_TIME_GET        0x02 /* - -> hour, min, sec */
+#define PROTO_OP_TIME_SET        0x03 /* hour, min, sec -> time read back */
+#define PROTO_OP_DATE_GET        0x04 /* - -> day, month, year (u16) */
+#define PROTO_OP_DATE_SET        0x05 /* day, month, year -> date read back */
+#define PROTO_OP_DATETIME_GET    0x06 /* - -> date, time */
+#define PROTO_OP_DATEDIFF_GET    0x07 /* - -> date, time */
+#define PROTO_OP_DATEDIFF_SET    0x08 /* date, time -> date, time */
+#define PROTO_OP_DATEDIFF_ENABLE 0x09 /* 0/1 -> 0/1 */
+#define PROTO_OP_BRIGHTNESS_GET  0x0a /* - -> 0..7 */
+#define PROTO_OP_BRIGHTNESS_SET  0x0b /* 0..7 -> 0..7 */
+#define PROTO_OP_TEMP_GET        0x0c /* - -> degrees (s8), hundredths */
+#define PROTO_OP_SOFT_CLOCK      0x0d /* 0/1 -> 0/1 */
+#define PROTO_OP_CLOCK_STATS     0x0e /* - -> soft, resyncs, drift, max (s16) */
+#define PROTO_OP_UART_STATS      0x0f /* - -> struct uart_stats (4 x u16) */
+#define PROTO_OP_POWER_STATS     0x10 /* - -> struct power_stats (3 x u16) */
+#define PROTO_OP_SAVE            0x11 /* - -> slot, seq, writes (u16) */
+#define PROTO_OP_TEXT            0x12 /* - -> - , text mode after this frame */
+#define PROTO_OP_BAUD            0x13 /* u32 -> u32, switch after this frame */
+#define PROTO_OP_RAM_STATS       0x14 /* - -> struct stack_stats (9 x u16) */
+#define PROTO_OP_ISR_STATS       0x15 /* index -> tick us, max, 8 counts (u16) */
+#define PROTO_OP_ISR_STATS_RESET 0x16 /* - -> - (both only with ISR_STATS) */
+#define PROTO_OP_DATETIME_SET    0x17 /* date, time -> date, time read back */
+#define PROTO_OP_PING            0x18 /* 7 bytes -> the same 7 bytes */
+#define PROTO_OP_AGING_GET       0x19 /* - -> RTC aging offset (s8) */
+#define PROTO_OP_AGING_SET       0x1a /* s8 -> aging offset read back */
+#define PROTO_OP_SHOW_TEXT       0x1b /* 16 chars, 0-padded -> - ("" = clock) */
+
+/*
+ * A request handler, called with arg_len bytes of argument. It writes res_len
+ * bytes of result and returns PROTO_OK, or returns an error status.
+ */
+struct proto_op {
+    u8 opcode;
+    u8 arg_len;
+    u8 res_len;
+    u8 (*fn)(const u8 *arg, u8 *res);
+};
+
+void proto_set_ops(const struct proto_op *ops, u8 num);
+void proto_enable(void);
+void proto_process(void);
+
+#endif
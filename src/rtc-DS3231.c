@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include "rtc.h"
+#include "datetime.h"
 #include "twi.h"
 #include "uart.h"
 
@@ -9,7 +10,8 @@
 
 #define REG_TIME_SEC        0x00
 #define REG_TIME_MIN        0x01
-#define REG_TIME_HOUR       0x03
+#define REG_TIME_HOUR       0x02
+#define REG_TIME_WEEKDAY    0x03
 
 #define REG_DATE_DAY        0x04
 #define REG_DATE_MONTH      0x05
@@ -30,20 +32,20 @@
 #define REG_TEMPI           0x11
 #define REG_TEMPF           0x12
 
+#define CONV 5
 #define INTCN 2
 #define A2IE 1
 #define A1IE 0
 
+#define BSY 2
+#define A2F 1
 #define A1F 0
 
-void rtc_init(void)
-{
-    /* Disable square wave signal and alarm interrupts */
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_CONTROL);
-    twi_write(1<<INTCN);
-    twi_stop();
-}
+/*
+ * Status register as we write it back. A1F/A2F can only be cleared (writing 1
+ * leaves them as is), so with both set writing this back changes nothing.
+ */
+static u8 status_shadow;
 
 static inline u8 bcd_decode(u8 bcd)
 {
@@ -54,128 +56,216 @@ static inline u8 bcd_encode(u8 dec)
     return ((dec / 10) << 4) | (dec % 10);
 }
 
-void rtc_read_time(struct time *ret)
+/* Burst read/write of consecutive registers, each a single transaction. */
+static void read_regs(u8 reg, u8 *buf, u8 num)
 {
-    u8 h, m, s;
-
     twi_start(TWI_ADDR, false);
-    twi_write(REG_TIME_SEC);
+    twi_write(reg);
 
     twi_start(TWI_ADDR, true);
-    s = twi_read(false);
-    m = twi_read(false);
-    h = twi_read(true);
+    while (num--)
+        *buf++ = twi_read(num == 0);
     twi_stop();
-
-    ret->sec = bcd_decode(s);
-    ret->min = bcd_decode(m);
-    ret->hour = bcd_decode(h);
 }
-
-void rtc_write_time(struct time *time)
+static void write_regs(u8 reg, const u8 *buf, u8 num)
 {
     twi_start(TWI_ADDR, false);
-    twi_write(REG_TIME_SEC);
-    twi_write(bcd_encode(time->sec));
-    twi_write(bcd_encode(time->min));
-    twi_write(bcd_encode(time->hour));
+    twi_write(reg);
+    while (num--)
+        twi_write(*buf++);
     twi_stop();
 }
 
-void rtc_read_date(struct date *ret)
+void rtc_init(void)
 {
-    u8 d, m, y;
+    u8 ctrl = 1<<INTCN;
 
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_DATE_DAY);
+    /* Disable square wave signal and alarm interrupts */
+    write_regs(REG_CONTROL, &ctrl, 1);
 
-    twi_start(TWI_ADDR, true);
-    d = twi_read(false);
-    m = twi_read(false);
-    y = twi_read(true);
-    twi_stop();
+    read_regs(REG_STATUS, &status_shadow, 1);
+    status_shadow |= 1<<A1F | 1<<A2F;
+}
+
+/* Decode registers starting at REG_TIME_SEC */
+static void decode_time(const u8 *regs, struct time *ret)
+{
+    ret->sec = bcd_decode(regs[0]);
+    ret->min = bcd_decode(regs[1]);
+    ret->hour = bcd_decode(regs[2]);
+}
 
-    ret->day = bcd_decode(d);
-    ret->month = bcd_decode(m & 0x7f);
-    ret->year = bcd_decode(y);
+/* Decode registers starting at REG_DATE_DAY */
+static void decode_date(const u8 *regs, struct date *ret)
+{
+    ret->day = bcd_decode(regs[0]);
+    ret->month = bcd_decode(regs[1] & 0x7f);
+    ret->year = bcd_decode(regs[2]);
     ret->year += 1900;
-    if (m & 0x80)
+    if (regs[1] & 0x80)
         ret->year += 100;
 }
 
-void rtc_write_date(struct date *date)
+/* Decode registers starting at REG_TEMPI */
+static void decode_temp(const u8 *regs, struct rtc_temp *ret)
+{
+    ret->temp = (s8)regs[0];
+    ret->fraction = (regs[1] >> 6) * 25;
+}
+
+void rtc_read_time(struct time *ret)
+{
+    u8 regs[3];
+
+    read_regs(REG_TIME_SEC, regs, sizeof(regs));
+    decode_time(regs, ret);
+}
+
+/* Encode registers starting at REG_TIME_SEC */
+static void encode_time(const struct time *time, u8 *regs)
+{
+    regs[0] = bcd_encode(time->sec);
+    regs[1] = bcd_encode(time->min);
+    regs[2] = bcd_encode(time->hour);
+}
+
+/* Encode registers starting at REG_TIME_WEEKDAY */
+static void encode_date(struct date *date, u8 *regs)
 {
-    u8 d, m, y;
     u16 year;
 
-    d = bcd_encode(date->day);
-    m = bcd_encode(date->month);
+    regs[0] = date_weekday(date);
+    regs[1] = bcd_encode(date->day);
+    regs[2] = bcd_encode(date->month);
     year = date->year - 1900;
-    if (year > 100) {
-        m |= 0x80;
+    if (year >= 100) {
+        regs[2] |= 0x80;
         year -= 100;
     }
-    y = bcd_encode(year);
+    regs[3] = bcd_encode(year);
+}
 
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_DATE_DAY);
-    twi_write(d);
-    twi_write(m);
-    twi_write(y);
-    twi_stop();
+/*
+ * Writing the seconds register also resets the countdown chain of the DS3231,
+ * so the new second starts when the write is done.
+ */
+void rtc_write_time(struct time *time)
+{
+    u8 regs[3];
+
+    encode_time(time, regs);
+    write_regs(REG_TIME_SEC, regs, sizeof(regs));
+}
+
+void rtc_read_date(struct date *ret)
+{
+    u8 regs[3];
+
+    read_regs(REG_DATE_DAY, regs, sizeof(regs));
+    decode_date(regs, ret);
+}
+
+void rtc_write_date(struct date *date)
+{
+    u8 regs[4];
+
+    encode_date(date, regs);
+    write_regs(REG_TIME_WEEKDAY, regs, sizeof(regs));
+}
+
+/* Write date and time in a single burst, starting a new second. */
+void rtc_write_datetime(struct datetime *datetime)
+{
+    u8 regs[REG_DATE_YEAR + 1];
+
+    encode_time(&datetime->time, &regs[REG_TIME_SEC]);
+    encode_date(&datetime->date, &regs[REG_TIME_WEEKDAY]);
+    write_regs(REG_TIME_SEC, regs, sizeof(regs));
+}
+
+/*
+ * Read date and time in a single burst, which also guarantees they are
+ * consistent with each other. The burst is extended up to the status and
+ * temperature registers when those are requested (non-NULL).
+ */
+void rtc_read_datetime(struct datetime *ret, u8 *status, struct rtc_temp *temp)
+{
+    u8 regs[REG_TEMPF + 1];
+    u8 num = REG_DATE_YEAR + 1;
+
+    if (temp)
+        num = REG_TEMPF + 1;
+    else if (status)
+        num = REG_STATUS + 1;
+
+    read_regs(REG_TIME_SEC, regs, num);
+
+    decode_time(&regs[REG_TIME_SEC], &ret->time);
+    decode_date(&regs[REG_DATE_DAY], &ret->date);
+    if (status)
+        *status = regs[REG_STATUS];
+    if (temp)
+        decode_temp(&regs[REG_TEMPI], temp);
 }
 
 void rtc_read_temp(struct rtc_temp *ret)
 {
-    s8 tempi;
-    u8 tempf;
+    u8 regs[2];
 
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_TEMPI);
+    read_regs(REG_TEMPI, regs, sizeof(regs));
+    decode_temp(regs, ret);
+}
 
-    twi_start(TWI_ADDR, true);
-    tempi = twi_read(false);
-    tempf = twi_read(true);
-    twi_stop();
+/*
+ * Aging offset, added to the capacitance of the crystal: one step is about
+ * 0.1 ppm at 25 C, positive values slow the oscillator down. The register is
+ * battery-backed like the time.
+ */
+s8 rtc_read_aging(void)
+{
+    u8 aging;
 
-    ret->temp = tempi;
-    ret->fraction = (tempf >> 6) * 25;
+    read_regs(REG_AGING, &aging, 1);
+    return aging;
 }
 
+void rtc_write_aging(s8 aging)
+{
+    u8 regs[2];
+
+    write_regs(REG_AGING, (u8 *)&aging, 1);
+
+    /* The oscillator is only adjusted on a temperature conversion, so start
+     * one now unless one is already busy. */
+    read_regs(REG_CONTROL, regs, sizeof(regs));
+    if (!(regs[1] & 1<<BSY)) {
+        regs[0] |= 1<<CONV;
+        write_regs(REG_CONTROL, regs, 1);
+    }
+}
 
 void rtc_enable_notifier(void)
 {
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_ALARM1_SEC);
-    twi_write(0x00); /* Match on seconds = 0 */
-    twi_write(0x80); /* Ignore minutes */
-    twi_write(0x80); /* Ignore hours */
-    twi_write(0x80); /* Ignore date */
-    twi_stop();
+    static const u8 alarm[] = {
+        0x00, /* Match on seconds = 0 */
+        0x80, /* Ignore minutes */
+        0x80, /* Ignore hours */
+        0x80, /* Ignore date */
+    };
+    u8 ctrl = 1<<INTCN | 1<<A1IE;
+
+    write_regs(REG_ALARM1_SEC, alarm, sizeof(alarm));
 
     /* Enable alarm0 interrupts */
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_CONTROL);
-    twi_write(1<<INTCN | 1<<A1IE);
-    twi_stop();
+    write_regs(REG_CONTROL, &ctrl, 1);
 
     rtc_notifier_handled();
 }
 
+/* Clear A1F using the shadow of the other status bits, without reading it. */
 void rtc_notifier_handled(void)
 {
-    u8 sts;
+    u8 sts = status_shadow & ~(1<<A1F);
 
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_STATUS);
-    twi_start(TWI_ADDR, true);
-    sts = twi_read(true);
-    twi_stop();
-
-    sts &= ~(1<<A1F);
-
-    twi_start(TWI_ADDR, false);
-    twi_write(REG_STATUS);
-    twi_write(sts);
-    twi_stop();
+    write_regs(REG_STATUS, &sts, 1);
 }
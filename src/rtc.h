@@ -3,6 +3,9 @@
 
 #include "types.h"
 
+/* Bits in the status returned by rtc_read_datetime() */
+#define RTC_STATUS_ALARM (1 << 0) /* Notifier alarm pending */
+
 struct rtc_temp {
     s8 temp;
     u8 fraction;
@@ -15,6 +18,10 @@ void rtc_write_time(struct time *time);
 void rtc_read_time(struct time *ret);
 void rtc_write_date(struct date *date);
 void rtc_read_date(struct date *ret);
+void rtc_write_datetime(struct datetime *datetime);
+void rtc_read_datetime(struct datetime *ret, u8 *status, struct rtc_temp *temp);
+s8 rtc_read_aging(void);
+void rtc_write_aging(s8 aging);
 void rtc_enable_notifier(void);
 void rtc_notifier_handled(void);
 
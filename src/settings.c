@@ -0,0 +1,107 @@
+#include <stddef.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "settings.h"
+
+struct record {
+    u8 seq;
+    u8 version;
+    struct settings settings;
+    u8 crc;
+};
+
+static struct record journal_ee[SETTINGS_SLOTS] EEMEM;
+
+static const struct settings defaults = {
+    .display_brightness = 1,
+    .datediff_enabled = 0,
+    .soft_clock = 0,
+    .datediff_target = {
+        .date = { .day = 1, .month = 1, .year = 2019 },
+        .time = { .hour = 0, .min = 0, .sec = 0 },
+    },
+};
+
+struct settings settings;
+
+static struct settings saved;   /* Contents of the newest record */
+static bool dirty;
+static u8 slot = SETTINGS_SLOTS - 1;
+static u8 seq = 0xff;
+static u16 writes;
+
+static u8 record_crc(const struct record *rec)
+{
+    const u8 *p = (const u8 *)rec;
+    u8 crc = 0;
+
+    for (u8 i = 0; i < offsetof(struct record, crc); i++)
+        crc = _crc8_ccitt_update(crc, p[i]);
+    return crc;
+}
+
+/*
+ * Find the newest valid record. Sequence numbers increase by one per record,
+ * and since there are far fewer slots than sequence numbers, the newest is the
+ * one that is ahead of all others (modulo 256).
+ */
+void settings_load(void)
+{
+    struct record rec;
+    bool found = false;
+
+    for (u8 i = 0; i < SETTINGS_SLOTS; i++) {
+        eeprom_read_block(&rec, &journal_ee[i], sizeof(rec));
+        if (rec.version != SETTINGS_VERSION || rec.crc != record_crc(&rec))
+            continue;
+        if (found && (s8)(rec.seq - seq) <= 0)
+            continue;
+        found = true;
+        slot = i;
+        seq = rec.seq;
+        saved = rec.settings;
+    }
+
+    if (!found)
+        saved = defaults;
+    settings = saved;
+    dirty = false;
+}
+
+/* Schedule the current settings to be saved by the next settings_flush(). */
+void settings_changed(void)
+{
+    dirty = true;
+}
+
+void settings_flush(void)
+{
+    struct record rec;
+
+    if (!dirty)
+        return;
+    dirty = false;
+    if (!memcmp(&settings, &saved, sizeof(settings)))
+        return;
+
+    memset(&rec, 0, sizeof(rec));
+    slot = (slot + 1) % SETTINGS_SLOTS;
+    rec.seq = ++seq;
+    rec.version = SETTINGS_VERSION;
+    rec.settings = settings;
+    rec.crc = record_crc(&rec);
+    eeprom_update_block(&rec, &journal_ee[slot], sizeof(rec));
+
+    saved = settings;
+    writes++;
+}
+
+void settings_get_stats(struct settings_stats *ret)
+{
+    ret->slot = slot;
+    ret->seq = seq;
+    ret->writes = writes;
+}
@@ -0,0 +1,43 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "types.h"
+
+/*
+ * Persistent settings, kept in a journal in EEPROM: every save appends a
+ * record (sequence number, format version, the settings and a CRC) to the
+ * next slot of a ring spanning SETTINGS_SLOTS records, so the writes are
+ * spread over the whole area. settings_load() picks the newest valid record.
+ *
+ * Changes are only marked by settings_changed() and written out by
+ * settings_flush(), which the main loop calls once a minute: a burst of
+ * commands results in (at most) a single record, and none if the settings end
+ * up as they were.
+ */
+#define SETTINGS_VERSION 1
+
+#ifndef SETTINGS_SLOTS
+# define SETTINGS_SLOTS 36
+#endif
+
+struct settings {
+    u8 display_brightness; /* 0..7 */
+    u8 datediff_enabled;
+    u8 soft_clock;
+    struct datetime datediff_target;
+};
+
+extern struct settings settings;
+
+struct settings_stats {
+    u8 slot;        /* Slot of the newest record */
+    u8 seq;         /* Its sequence number */
+    u16 writes;     /* Records written since reset */
+};
+
+void settings_load(void);
+void settings_changed(void);
+void settings_flush(void);
+void settings_get_stats(struct settings_stats *ret);
+
+#endif
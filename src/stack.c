@@ -0,0 +1,58 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "stack.h"
+
+/* From the linker script: end of .bss, and the initial stack pointer. */
+extern u8 _end;
+extern u8 __stack;
+
+volatile u16 stack_isr_depth[STACK_NUM_ISRS];
+
+/*
+ * Paint RAM from the end of .bss up to the top of the stack. This runs from
+ * .init1, before the C runtime has set up the stack pointer and the zero
+ * register, so it cannot be C.
+ */
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
+void stack_paint(void)
+{
+    __asm__ volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (STACK_CANARY));
+}
+
+/* Bytes after .bss that still hold the paint. */
+static u16 unused(void)
+{
+    const u8 *p = &_end;
+
+    while (p <= &__stack && *p == STACK_CANARY)
+        p++;
+    return p - &_end;
+}
+
+void stack_get_stats(struct stack_stats *ret)
+{
+    u8 sreg;
+
+    ret->data = (u16)&_end - RAMSTART;
+    ret->unused = unused();
+    ret->stack_max = (u16)(&__stack - &_end) + 1 - ret->unused;
+    ret->free = SP - (u16)&_end;
+
+    sreg = SREG;
+    cli();
+    for (u8 i = 0; i < STACK_NUM_ISRS; i++)
+        ret->isr_depth[i] = stack_isr_depth[i];
+    SREG = sreg;
+}
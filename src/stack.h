@@ -0,0 +1,55 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <avr/io.h>
+
+#include "types.h"
+
+/*
+ * RAM usage instrumentation. At reset all RAM above .bss is painted with
+ * STACK_CANARY, so the deepest the stack ever got is where the paint stops.
+ * On top of that every ISR records the stack depth (from RAMEND, including
+ * the registers it saved) it was entered at, which shows how much headroom
+ * each interrupt source costs on top of the code it interrupts.
+ */
+#define STACK_CANARY 0xc5
+
+/* Set to 0 to leave the depth tracking out of the ISRs. */
+#ifndef STACK_ISR_DEPTH
+# define STACK_ISR_DEPTH 1
+#endif
+
+enum stack_isr {
+    STACK_ISR_INT1,
+    STACK_ISR_TIMER1,
+    STACK_ISR_LIN,
+    STACK_ISR_PCINT0,
+    STACK_ISR_TIMER0,
+    STACK_NUM_ISRS,
+};
+
+struct stack_stats {
+    u16 data;       /* .data and .bss */
+    u16 stack_max;  /* Stack high-water mark since reset */
+    u16 unused;     /* RAM between .bss and the stack never written */
+    u16 free;       /* RAM between .bss and the stack pointer now */
+    u16 isr_depth[STACK_NUM_ISRS];
+};
+
+extern volatile u16 stack_isr_depth[STACK_NUM_ISRS];
+
+/* Call first thing in an ISR. */
+#if STACK_ISR_DEPTH
+# define STACK_ISR(isr) \
+    do { \
+        u16 ___depth = RAMEND - SP; \
+        if (___depth > stack_isr_depth[isr]) \
+            stack_isr_depth[isr] = ___depth; \
+    } while (0)
+#else
+# define STACK_ISR(isr) do { } while (0)
+#endif
+
+void stack_get_stats(struct stack_stats *ret);
+
+#endif
@@ -0,0 +1,42 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+
+#include "sysclk.h"
+
+#if SYSCLK_FAST_SHIFT > SYSCLK_SLOW_SHIFT
+# error "F_CPU must be 8, 4, 2 or 1 MHz, and faster than the slow clock"
+#endif
+
+static u8 cur_shift = 3; /* CKDIV8 fuse */
+
+/*
+ * The new prescaler must be written within 4 cycles of CLKPCE, which
+ * clock_prescale_set() guarantees. Interrupts see cur_shift change along
+ * with the clock.
+ */
+static void set_shift(u8 shift)
+{
+    u8 sreg = SREG;
+
+    cli();
+    clock_prescale_set((clock_div_t)shift);
+    cur_shift = shift;
+    SREG = sreg;
+}
+
+/* Also used at startup, to switch from the clock the fuses left us at. */
+void sysclk_fast(void)
+{
+    set_shift(SYSCLK_FAST_SHIFT);
+}
+
+void sysclk_slow(void)
+{
+    set_shift(SYSCLK_SLOW_SHIFT);
+}
+
+u32 sysclk_hz(void)
+{
+    return SYSCLK_OSC >> cur_shift;
+}
@@ -0,0 +1,32 @@
+#ifndef SYSCLK_H
+#define SYSCLK_H
+
+#include "types.h"
+
+/*
+ * CPU clock scaling through CLKPR. The system clock is the internal 8 MHz RC
+ * oscillator divided by a power of two.
+ *
+ * F_CPU (CLOCKRATE in the makefile) is the fast clock, which all work runs
+ * at: _delay_us() and the timer periods of the display and TWI drivers are
+ * computed for it at compile time. Only while waiting for the UART, with
+ * nothing else running, does the power manager drop to the slow clock; the
+ * LIN/UART baud rate is recomputed for the current clock, see sysclk_hz().
+ *
+ * The slow clock is the slowest at which the LIN/UART still receives 9600
+ * baud (see uart.c); the slowest divider (256, 31.25 kHz) cannot.
+ */
+#define SYSCLK_OSC 8000000UL
+
+#define SYSCLK_FAST_SHIFT \
+    (F_CPU == SYSCLK_OSC ? 0 : F_CPU == SYSCLK_OSC / 2 ? 1 : \
+     F_CPU == SYSCLK_OSC / 4 ? 2 : F_CPU == SYSCLK_OSC / 8 ? 3 : 0xff)
+#ifndef SYSCLK_SLOW_SHIFT
+# define SYSCLK_SLOW_SHIFT 5 /* 250 kHz */
+#endif
+
+void sysclk_fast(void);
+void sysclk_slow(void);
+u32 sysclk_hz(void);
+
+#endif
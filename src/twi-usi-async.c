@@ -0,0 +1,357 @@
+/*
+ * Interrupt driven TWI (I2C) over the USI.
+ *
+ * The bus handling is the same as in twi-usi.c (Note AVR310), but instead of
+ * busy-waiting between SCL edges, every step of a transfer is performed from
+ * the Timer0 compare interrupt, one half SCL period apart. The CPU is free (or
+ * asleep) in between, at the cost of a slower bus clock.
+ *
+ * A slave may stretch the clock by holding SCL low after we released it. The
+ * steps that need SCL high then wait for it, retrying on the next interrupt.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+
+#include "twi.h"
+#include "pins.h"
+#include "uart.h"
+#include "stack.h"
+#include "isrstats.h"
+
+#if ISR_STATS
+# error "ISR_STATS uses Timer0, which twi-usi-async needs"
+#endif
+
+/* Configuration data of USI module (we write this into USICR). */
+#define USI_CONF (0<<USISIE | 0<<USIOIE |            /* Disable Interrupts */  \
+                  1<<USIWM1 | 0<<USIWM0 |            /* Two-wire mode */       \
+                  1<<USICS1 | 0<<USICS0 | 1<<USICLK) /* Software clock */
+
+/* Reset USI status (written into USISR) */
+#define USI_STATUS_RESET                                                       \
+                (1<<USISIF | 1<<USIOIF | /* Clear interrupt flags */           \
+                 1<<USIPF |              /* Clear stop condition flag */       \
+                 1<<USIDC |              /* Clear data output collision flag */\
+                 0x0<<USICNT0)           /* Reset 4-bit counter */
+
+/*
+ * Time between two steps (half an SCL period). Every step costs an interrupt,
+ * so at 1 MHz this should not be much below 50us.
+ */
+#ifndef TWI_HALF_PERIOD_US
+# define TWI_HALF_PERIOD_US 50
+#endif
+
+#define TIMER_PRESCALER 8
+#define TIMER_TOP ((F_CPU / TIMER_PRESCALER) * TWI_HALF_PERIOD_US / 1000000UL - 1)
+#if TIMER_TOP < 1 || TIMER_TOP > 255
+# error "TWI_HALF_PERIOD_US out of range for Timer0"
+#endif
+
+enum state {
+    ST_IDLE,
+    ST_START,       /* Release SCL */
+    ST_START_SDA,   /* Pull SDA low once SCL is high */
+    ST_START_SCL,   /* Pull SCL low, send address */
+    ST_DATA,        /* Continue an open transfer with the next byte */
+    ST_SHIFT,       /* Clocking bits through the USI */
+    ST_STOP,        /* Pull SDA low and release SCL */
+    ST_STOP_SDA,    /* Release SDA once SCL is high */
+};
+
+/* What is being clocked through the USI in ST_SHIFT. */
+enum shift {
+    SH_ADDR,
+    SH_ADDR_ACK,
+    SH_TX,
+    SH_TX_ACK,
+    SH_RX,
+    SH_RX_ACK,
+};
+
+static volatile u8 state = ST_IDLE;
+static u8 shift;
+
+static u8 xfer_addr;
+static u8 xfer_flags;
+static u8 *xfer_buf;
+static u8 xfer_len;
+static twi_done_cb_t xfer_cb;
+static volatile bool xfer_ok = true;
+
+void twi_init(void)
+{
+    /* Pull-up on SDA and SCL and set as outputs */
+    pin_write(PIN_TWI_SDA, 1);
+    pin_write(PIN_TWI_SCL, 1);
+    pin_set_mode(PIN_TWI_SCL, OUTPUT);
+    pin_set_mode(PIN_TWI_SDA, OUTPUT);
+
+    /* Timer0 in CTC mode, only running (and powered) during transfers */
+    power_timer0_enable();
+    TCCR0A = 1<<WGM01;
+    TCCR0B = 0;
+    OCR0A = TIMER_TOP;
+    power_timer0_disable();
+}
+
+/*
+ * The USI is only powered from START to STOP, and has to be set up again each
+ * time it is powered on.
+ */
+static void usi_enable(void)
+{
+    power_usi_enable();
+
+    /* Preload data register with "released level" data */
+    USIDR = 0xFF;
+
+    USICR = USI_CONF;
+    USISR = USI_STATUS_RESET;
+}
+
+static void timer_start(void)
+{
+    power_timer0_enable();
+    TCNT0 = 0;
+    TIFR0 = 1<<OCF0A;
+    TIMSK0 = 1<<OCIE0A;
+    TCCR0B = 1<<CS01; /* clk/8 */
+}
+
+static void timer_stop(void)
+{
+    TCCR0B = 0;
+    TIMSK0 = 0;
+    power_timer0_disable();
+}
+
+/* Clock num_bits (1 or 8) through the USI, see transfer() in twi-usi.c. */
+static void shift_bits(u8 num_bits, u8 what)
+{
+    shift = what;
+    USISR = USI_STATUS_RESET | (16 - num_bits * 2)<<USICNT0;
+    state = ST_SHIFT;
+}
+
+static void complete(void)
+{
+    timer_stop();
+    state = ST_IDLE;
+    if (xfer_cb)
+        xfer_cb(xfer_ok);
+}
+
+static void finish(bool ok)
+{
+    xfer_ok = ok;
+    if (!ok || !(xfer_flags & TWI_NOSTOP))
+        state = ST_STOP;
+    else
+        complete();
+}
+
+static void next_byte(void)
+{
+    if (!xfer_len) {
+        finish(true);
+    } else if (xfer_flags & TWI_READ) {
+        pin_set_mode(PIN_TWI_SDA, INPUT);
+        shift_bits(8, SH_RX);
+    } else {
+        USIDR = *xfer_buf;
+        shift_bits(8, SH_TX);
+    }
+}
+
+static void shift_done(void)
+{
+    u8 data;
+
+    /* Read data sent by slave (if applicable) and release SDA */
+    data = USIDR;
+    USIDR = 0xFF;
+    pin_set_mode(PIN_TWI_SDA, OUTPUT);
+
+    switch (shift) {
+    case SH_ADDR:
+    case SH_TX:
+        /* Read ACK bit */
+        pin_set_mode(PIN_TWI_SDA, INPUT);
+        shift_bits(1, shift == SH_ADDR ? SH_ADDR_ACK : SH_TX_ACK);
+        break;
+    case SH_ADDR_ACK:
+    case SH_TX_ACK:
+        if (data & 1) {
+            LOGF("ERROR: No ACK for address %u", xfer_addr);
+            finish(false);
+            break;
+        }
+        if (shift == SH_TX_ACK) {
+            xfer_buf++;
+            xfer_len--;
+        }
+        next_byte();
+        break;
+    case SH_RX:
+        *xfer_buf++ = data;
+        xfer_len--;
+        /* Send ACK, or NACK for last byte */
+        USIDR = xfer_len || (xfer_flags & TWI_READ_MORE) ? 0x00 : 0xff;
+        shift_bits(1, SH_RX_ACK);
+        break;
+    case SH_RX_ACK:
+        next_byte();
+        break;
+    }
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+    STACK_ISR(STACK_ISR_TIMER0);
+
+    switch (state) {
+    case ST_START:
+        pin_write(PIN_TWI_SCL, 1);
+        state = ST_START_SDA;
+        break;
+    case ST_START_SDA:
+        if (!pin_read(PIN_TWI_SCL))
+            break; /* Stretched */
+        pin_write(PIN_TWI_SDA, 0);
+        state = ST_START_SCL;
+        break;
+    case ST_START_SCL:
+        pin_write(PIN_TWI_SCL, 0);
+        pin_write(PIN_TWI_SDA, 1);
+
+        /* Verify start condition detector picked up start condition */
+        if (!(USISR & (1<<USISIF))) {
+            LOG("ERROR: Could not start TWI transfer");
+            finish(false);
+            break;
+        }
+
+        /* Write target address and R/W flag */
+        USIDR = (xfer_addr << 1) | !!(xfer_flags & TWI_READ);
+        shift_bits(8, SH_ADDR);
+        break;
+    case ST_DATA:
+        next_byte();
+        break;
+    case ST_SHIFT:
+        /*
+         * Toggle SCL; the USI counter overflows on the last falling edge. It
+         * counts both edges, so when it is odd SCL was released, and the
+         * falling edge has to wait while the slave stretches the clock.
+         */
+        if ((USISR & 1<<USICNT0) && !pin_read(PIN_TWI_SCL))
+            break;
+        USICR = USI_CONF | 1<<USITC;
+        if (USISR & (1<<USIOIF))
+            shift_done();
+        break;
+    case ST_STOP:
+        pin_write(PIN_TWI_SDA, 0);
+        pin_write(PIN_TWI_SCL, 1);
+        state = ST_STOP_SDA;
+        break;
+    case ST_STOP_SDA:
+        if (!pin_read(PIN_TWI_SCL))
+            break; /* Stretched */
+        pin_write(PIN_TWI_SDA, 1);
+        power_usi_disable();
+        complete();
+        break;
+    }
+}
+
+/*
+ * Start a transfer of len bytes from/to buf. Unless TWI_NOSTART is given the
+ * transfer begins with a (repeated) START and the address. cb is called from
+ * interrupt context once done. Returns false if a transfer is still running.
+ */
+bool twi_transfer_async(u8 addr, u8 flags, u8 *buf, u8 len, twi_done_cb_t cb)
+{
+    if (state != ST_IDLE)
+        return false;
+
+    xfer_addr = addr;
+    xfer_flags = flags;
+    xfer_buf = buf;
+    xfer_len = len;
+    xfer_cb = cb;
+    xfer_ok = true;
+    if (flags & TWI_NOSTART) {
+        state = ST_DATA;
+    } else {
+        usi_enable();
+        state = ST_START;
+    }
+    timer_start();
+    return true;
+}
+
+bool twi_busy(void)
+{
+    return state != ST_IDLE;
+}
+
+/*
+ * Sleep until the current transfer (if any) is done and return whether it
+ * succeeded. Interrupts are enabled while waiting.
+ */
+bool twi_wait(void)
+{
+    u8 sreg = SREG;
+
+    for (;;) {
+        cli();
+        if (state == ST_IDLE)
+            break;
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    SREG = sreg;
+    return xfer_ok;
+}
+
+/*
+ * Blocking API, as a single-step transfer each.
+ */
+static bool transfer(u8 addr, u8 flags, u8 *buf, u8 len)
+{
+    twi_wait();
+    twi_transfer_async(addr, flags, buf, len, NULL);
+    return twi_wait();
+}
+
+/* Can be used for repeated start as well */
+bool twi_start(u8 addr, bool do_read)
+{
+    return transfer(addr, TWI_NOSTOP | (do_read ? TWI_READ : 0), NULL, 0);
+}
+
+void twi_stop(void)
+{
+    transfer(0, TWI_NOSTART, NULL, 0);
+}
+
+bool twi_write(u8 data)
+{
+    return transfer(0, TWI_NOSTART | TWI_NOSTOP, &data, 1);
+}
+
+u8 twi_read(bool last_read)
+{
+    u8 data = 0xff;
+
+    transfer(0, TWI_READ | TWI_NOSTART | TWI_NOSTOP |
+             (last_read ? 0 : TWI_READ_MORE), &data, 1);
+    return data;
+}
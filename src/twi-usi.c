@@ -2,6 +2,7 @@
  * Implement TWI (I2C) over the USI, following Note AVR310.
  */
 
+#include <avr/power.h>
 #include <util/delay.h>
 
 #include "twi.h"
@@ -20,6 +21,9 @@
                  1<<USIDC |              /* Clear data output collision flag */\
                  0x0<<USICNT0)           /* Reset 4-bit counter */
 
+/* Result of the last twi_transfer_async() */
+static bool last_ok = true;
+
 void twi_init(void)
 {
     /* Pull-up on SDA and SCL and set as outputs */
@@ -27,6 +31,15 @@ void twi_init(void)
     pin_write(PIN_TWI_SCL, 1);
     pin_set_mode(PIN_TWI_SCL, OUTPUT);
     pin_set_mode(PIN_TWI_SDA, OUTPUT);
+}
+
+/*
+ * The USI is only powered from START to STOP, and has to be set up again each
+ * time it is powered on.
+ */
+static void usi_enable(void)
+{
+    power_usi_enable();
 
     /* Preload data register with "released level" data */
     USIDR = 0xFF;
@@ -78,6 +91,8 @@ static u8 transfer(u8 num_bits)
 /* Can be used for repeated start as well */
 bool twi_start(u8 addr, bool do_read)
 {
+    usi_enable();
+
     /* Release SCL */
     pin_write(PIN_TWI_SCL, 1);
     while (!pin_read(PIN_TWI_SCL))
@@ -119,6 +134,8 @@ void twi_stop(void)
     delay_short();
     pin_write(PIN_TWI_SDA, 1);
     delay_long();
+
+    power_usi_disable();
 }
 
 bool twi_write(u8 data)
@@ -148,3 +165,38 @@ u8 twi_read(bool last_read)
 
     return data;
 }
+
+/*
+ * The transfer API on top of the blocking primitives; the transfer has
+ * completed (and cb has been called) by the time this returns.
+ */
+bool twi_transfer_async(u8 addr, u8 flags, u8 *buf, u8 len, twi_done_cb_t cb)
+{
+    bool ok = true;
+
+    if (!(flags & TWI_NOSTART))
+        ok = twi_start(addr, flags & TWI_READ);
+    while (ok && len--) {
+        if (flags & TWI_READ)
+            *buf++ = twi_read(!len && !(flags & TWI_READ_MORE));
+        else
+            ok = twi_write(*buf++);
+    }
+    if (!ok || !(flags & TWI_NOSTOP))
+        twi_stop();
+
+    last_ok = ok;
+    if (cb)
+        cb(ok);
+    return true;
+}
+
+bool twi_busy(void)
+{
+    return false;
+}
+
+bool twi_wait(void)
+{
+    return last_ok;
+}
@@ -3,10 +3,22 @@
 
 #include "types.h"
 
+/* Flags for twi_transfer_async() */
+#define TWI_READ      (1 << 0) /* Read from the device instead of writing */
+#define TWI_NOSTART   (1 << 1) /* Continue the open transfer, no START/address */
+#define TWI_NOSTOP    (1 << 2) /* Keep the bus for a following transfer */
+#define TWI_READ_MORE (1 << 3) /* ACK the last byte read, more reads follow */
+
+typedef void (*twi_done_cb_t)(bool ok);
+
 void twi_init(void);
 bool twi_start(u8 addr, bool do_read);
 void twi_stop(void);
 bool twi_write(u8 data);
 u8 twi_read(bool last_read);
 
+bool twi_transfer_async(u8 addr, u8 flags, u8 *buf, u8 len, twi_done_cb_t cb);
+bool twi_busy(void);
+bool twi_wait(void);
+
 #endif
@@ -7,8 +7,10 @@
 typedef int8_t s8;
 typedef uint8_t u8;
 typedef uint16_t u16;
+typedef uint32_t u32;
 
 typedef int16_t s16;
+typedef int32_t s32;
 
 struct time {
     u8 sec;
@@ -0,0 +1,67 @@
+#ifndef UART_BAUD_H
+#define UART_BAUD_H
+
+/*
+ * Baud rates supported by the LIN/UART at F_CPU, each with the bit time in
+ * samples (LBT, 8..63) it uses: baud = clock / (LBT * (LDIV + 1)) (15.5.6.1,
+ * formula incorrect in datasheet). The first entry is the rate after reset.
+ *
+ * A bit time of 26 works out nicely for 9600 baud at every clock from 8 MHz
+ * down to the slow clock (250 kHz, where LDIV is 0); some of the faster rates
+ * need a different one to get close enough. The build fails when any rate is
+ * off by more than UART_BAUD_MAX_ERROR.
+ *
+ * UART_BAUD_FASTEST is the highest rate in the table, which bounds how long
+ * interrupts may stay disabled without the receiver overrunning.
+ */
+#if F_CPU == 8000000UL
+# define UART_BAUD_TABLE(X) \
+    X(9600, 26) X(19200, 26) X(38400, 26) X(57600, 23) X(115200, 23)
+# define UART_BAUD_FASTEST 115200UL
+#elif F_CPU == 4000000UL
+# define UART_BAUD_TABLE(X) \
+    X(9600, 26) X(19200, 26) X(38400, 26) X(57600, 23) X(115200, 35)
+# define UART_BAUD_FASTEST 115200UL
+#elif F_CPU == 2000000UL
+# define UART_BAUD_TABLE(X) \
+    X(9600, 26) X(19200, 26) X(38400, 26) X(57600, 35)
+# define UART_BAUD_FASTEST 57600UL
+#else
+# define UART_BAUD_TABLE(X) \
+    X(9600, 26) X(19200, 26) X(38400, 26)
+# define UART_BAUD_FASTEST 38400UL
+#endif
+
+/* Largest acceptable error of the actual rate, in tenths of a percent. */
+#ifndef UART_BAUD_MAX_ERROR
+# define UART_BAUD_MAX_ERROR 20
+#endif
+
+/*
+ * The rounded divider (LDIV + 1) for a rate at a clock, the rate that gives
+ * and its error in tenths of a percent. Usable at compile and at run time.
+ */
+#define UART_BAUD_N(hz, baud, lbt) \
+    ((hz) < (lbt) * (baud) ? 1 : ((hz) + (lbt) * (baud) / 2) / ((lbt) * (baud)))
+#define UART_BAUD_REAL(hz, baud, lbt) ((hz) / ((lbt) * UART_BAUD_N(hz, baud, lbt)))
+#define UART_BAUD_ERROR(hz, baud, lbt) \
+    ((UART_BAUD_REAL(hz, baud, lbt) > (baud) ? \
+      UART_BAUD_REAL(hz, baud, lbt) - (baud) : \
+      (baud) - UART_BAUD_REAL(hz, baud, lbt)) * 1000 / (baud))
+
+#define UART_BAUD_CHECK(baud, lbt) \
+    _Static_assert((lbt) >= 8 && (lbt) <= 63 && \
+            UART_BAUD_ERROR(F_CPU, baud##UL, lbt) <= UART_BAUD_MAX_ERROR, \
+            #baud " baud is off by more than UART_BAUD_MAX_ERROR at F_CPU"); \
+    _Static_assert(baud##UL <= UART_BAUD_FASTEST, \
+            #baud " baud is faster than UART_BAUD_FASTEST");
+UART_BAUD_TABLE(UART_BAUD_CHECK)
+
+struct uart_baud {
+    u32 baud;
+    u8 lbt;
+};
+
+#define UART_BAUD_ENTRY(baud, lbt) { baud, lbt },
+
+#endif
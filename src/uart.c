@@ -2,37 +2,90 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/cpufunc.h>
+#include <avr/power.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 
 #include "uart.h"
+#include "uart-baud.h"
+#include "events.h"
+#include "sysclk.h"
+#include "stack.h"
+#include "isrstats.h"
 
-#define BAUDRATE 9600UL
+#if UART_TX_BUF_SIZE & (UART_TX_BUF_SIZE - 1) || UART_TX_BUF_SIZE > 256
+# error "UART_TX_BUF_SIZE must be a power of two, at most 256"
+#endif
+#define TX_MASK (UART_TX_BUF_SIZE - 1)
+
+#define RECV_BUF_MAX 32
+
+/*
+ * Waiting for room with interrupts enabled, for the Tx interrupt to be taken.
+ * A hook for the host build, whose Tx interrupt only comes when asked for.
+ */
+#ifndef UART_TX_WAIT
+# define UART_TX_WAIT() _NOP()
+#endif
 
 FILE uart_fd = FDEV_SETUP_STREAM(uart_fputc, NULL, _FDEV_SETUP_WRITE);
 
-#define RECV_BUF_MAX 32
-static char recv_buf[RECV_BUF_MAX];
-static unsigned char recv_buf_size = 0;
+/*
+ * Transmit ring buffer, drained from the transfer complete interrupt. The
+ * transmitter is running exactly when the LENTXOK interrupt is enabled.
+ */
+static volatile char tx_buf[UART_TX_BUF_SIZE];
+static volatile u8 tx_head, tx_tail;
+
+/*
+ * Receive queue of complete lines. The ISR fills rx_lines[rx_head] and only
+ * publishes it (by incrementing rx_count) once the line is terminated, so the
+ * line handed to the callback is never written to while it is processed.
+ */
+static char rx_lines[UART_RX_LINES][RECV_BUF_MAX];
+static volatile u8 rx_head, rx_tail, rx_count;
+static u8 rx_len;
+static volatile bool rx_echo = true;
+static volatile uart_raw_cb_t rx_raw;
+
+/* Why the line currently being received is thrown away, if it is. */
+#define RX_KEEP     0
+#define RX_OVERFLOW 1
+#define RX_DROPPED  2
+static u8 rx_discard;
+
+static volatile struct uart_stats stats;
 static uart_recv_cb_t recv_cb = NULL;
 
-void uart_init(void)
+static const struct uart_baud bauds[] PROGMEM = {
+    UART_BAUD_TABLE(UART_BAUD_ENTRY)
+};
+#define NUM_BAUDS (sizeof(bauds) / sizeof(bauds[0]))
+#define BAUD_NONE 0xff
+
+/* Current rate, and the one to switch to once the transmitter is idle. */
+static struct uart_baud baud;
+static volatile u8 baud_next = BAUD_NONE;
+
+static void set_baud(void)
 {
-    int lbt, div;
+    u16 div = UART_BAUD_N(sysclk_hz(), baud.baud, baud.lbt) - 1;
 
+    LINBRRL = div & 0xff;
+    LINBRRH = (div >> 8) & 0xff;
+}
+
+/* Configure the LIN/UART, which has to be redone after it was powered off. */
+static void lin_setup(void)
+{
     /*
      * Software reset the LIN/UART controller.
      */
     LINCR = 1 << LSWRES;
 
-    /*
-     * Set baudrate (15.5.6.1, formula incorrect in datasheet).
-     */
-    lbt = 26; /* Prescaler - 26 works out nicely for 9600 @ 1MHz */
-    /* Add half of baudrate for better rounding */
-    div = (F_CPU + (lbt / 2) * BAUDRATE) / (lbt * BAUDRATE) - 1;
-    LINBTR = (1<<LDISR) | lbt;
-    LINBRRL = div & 0xff;
-    LINBRRH = (div >> 8) & 0xff;
+    LINBTR = (1<<LDISR) | baud.lbt;
+    set_baud();
 
     /*
      * Enable Rx interrupts/
@@ -47,42 +100,223 @@ void uart_init(void)
             (1 << LCMD1) | /* Rx */
             (1 << LCMD0) /* Tx */
             ; /* LCONF[0:1] = 0 - 8N1 */
+}
 
+void uart_init(void)
+{
+    memcpy_P(&baud, &bauds[0], sizeof(baud));
+    lin_setup();
     stdout = stderr = &uart_fd;
 }
 
-/* Rx interrupt */
-ISR(LIN_TC_vect)
+/* Whether everything queued has been sent, i.e., the transmitter stopped. */
+bool uart_tx_idle(void)
 {
-    char val;
+    return !(LINENIR & (1 << LENTXOK));
+}
+
+/*
+ * Power the LIN/UART down and back up, e.g., around power-down sleep. Should
+ * only be suspended when uart_tx_idle(). A line being received is discarded,
+ * and the baud rate and text mode come back as after reset, so a client that
+ * went away without restoring them does not leave the clock unreachable (a
+ * frame in progress is dropped; proto_enable() starts over at the sync byte).
+ */
+void uart_suspend(void)
+{
+    power_lin_disable();
+}
+
+/*
+ * Whether a byte is being received (or sent). The clock should not be changed
+ * then, as the bit timing would be off for the rest of the byte.
+ */
+bool uart_busy(void)
+{
+    return LINSIR & (1 << LBUSY);
+}
+
+/* Call after changing the system clock. */
+void uart_clock_changed(void)
+{
+    set_baud();
+}
+
+/* Whether the current baud rate can be kept at a system clock of hz. */
+bool uart_clock_ok(u32 hz)
+{
+    return UART_BAUD_ERROR(hz, baud.baud, baud.lbt) <= UART_BAUD_MAX_ERROR;
+}
+
+static u8 find_baud(u32 rate)
+{
+    for (u8 i = 0; i < NUM_BAUDS; i++)
+        if (pgm_read_dword(&bauds[i].baud) == rate)
+            return i;
+    return BAUD_NONE;
+}
+
+bool uart_baud_supported(u32 rate)
+{
+    return find_baud(rate) != BAUD_NONE;
+}
+
+/* Reconfigure for baud_next. Only when the transmitter is idle. */
+static void switch_baud(void)
+{
+    memcpy_P(&baud, &bauds[baud_next], sizeof(baud));
+    baud_next = BAUD_NONE;
+    lin_setup();
+    rx_len = 0;
+    rx_discard = RX_KEEP;
+}
+
+/*
+ * Switch to another supported baud rate, once everything queued for sending
+ * has gone out at the current one. Returns false if rate is not supported.
+ */
+bool uart_set_baud(u32 rate)
+{
+    u8 sreg;
+    u8 i = find_baud(rate);
+
+    if (i == BAUD_NONE)
+        return false;
 
+    sreg = SREG;
     cli();
+    baud_next = i;
+    if (uart_tx_idle())
+        switch_baud();
+    SREG = sreg;
+    return true;
+}
+
+u32 uart_get_baud(void)
+{
+    return baud.baud;
+}
+
+void uart_resume(void)
+{
+    u8 sreg = SREG;
+
+    cli();
+    power_lin_enable();
+    memcpy_P(&baud, &bauds[0], sizeof(baud));
+    baud_next = BAUD_NONE;
+    lin_setup();
+    rx_len = 0;
+    rx_discard = RX_KEEP;
+    rx_raw = NULL;
+    SREG = sreg;
+}
+
+/* Send the next byte from the Tx buffer, or stop the transmitter. */
+static void tx_next(void)
+{
+    LINSIR = 1 << LTXOK; /* Clear flag */
+    if (tx_head == tx_tail) {
+        LINENIR &= ~(1 << LENTXOK);
+        if (baud_next != BAUD_NONE)
+            switch_baud();
+        return;
+    }
+    LINDAT = tx_buf[tx_tail];
+    tx_tail = (tx_tail + 1) & TX_MASK;
+}
+
+static void rx_byte(void)
+{
+    char val;
 
     val = LINDAT; /* Read data and re-enable Rx interrupts. */
 
-    /* TODO */
-    uart_putchar(val);
+    if (rx_raw) {
+        rx_raw(val);
+        return;
+    }
+
+    if (rx_echo)
+        uart_putchar(val);
 
     if (val == '\n' || val == '\r') {
-        if (recv_buf_size) {
-            recv_buf[recv_buf_size] = '\0';
-            recv_buf_size = 0;
-            if (recv_cb)
-                recv_cb(recv_buf);
+        if (rx_discard == RX_OVERFLOW) {
+            stats.rx_overflow++;
+        } else if (rx_discard == RX_DROPPED) {
+            stats.rx_dropped++;
+        } else if (rx_len) {
+            rx_lines[rx_head][rx_len] = '\0';
+            rx_head = (rx_head + 1) % UART_RX_LINES;
+            rx_count++;
+            events_post(EV_UART_RX);
         }
-    } else {
-        recv_buf[recv_buf_size++] = val;
-        if (recv_buf_size == RECV_BUF_MAX - 1)
-            recv_buf_size = 0;
+        rx_len = 0;
+        rx_discard = RX_KEEP;
+    } else if (rx_discard == RX_KEEP) {
+        if (rx_count == UART_RX_LINES)
+            rx_discard = RX_DROPPED;
+        else if (rx_len == RECV_BUF_MAX - 1)
+            rx_discard = RX_OVERFLOW;
+        else
+            rx_lines[rx_head][rx_len++] = val;
     }
+}
+
+/* Rx and Tx interrupt */
+ISR(LIN_TC_vect)
+{
+    u8 sts = LINSIR;
+    ISRSTATS_ENTER();
+
+    STACK_ISR(STACK_ISR_LIN);
 
-    sei();
+    if (sts & (1 << LERR)) {
+        if (LINERR & (1 << LOVERR))
+            stats.rx_overrun++;
+        LINSIR = 1 << LERR; /* Clear flag and LINERR */
+    }
+    if (sts & (1 << LTXOK))
+        tx_next();
+    if (sts & (1 << LRXOK))
+        rx_byte();
+    ISRSTATS_EXIT(STACK_ISR_LIN);
 }
 
 char uart_putchar(const char c)
 {
-    loop_until_bit_is_clear(LINSIR, LBUSY);
-    LINDAT = c;
+    u8 sreg = SREG;
+    u8 next;
+
+    /* ISRs send too (the echo, error LOGs), so take the slot atomically. */
+    cli();
+    while ((next = (tx_head + 1) & TX_MASK) == tx_tail) {
+#if UART_TX_DROP
+        stats.tx_dropped++;
+        SREG = sreg;
+        return c;
+#else
+        /* With interrupts disabled (e.g., in an ISR) nobody drains the
+         * buffer for us, so wait for the byte in flight ourselves. */
+        if (!(sreg & (1 << SREG_I))) {
+            loop_until_bit_is_set(LINSIR, LTXOK);
+            tx_next();
+        } else {
+            SREG = sreg;
+            UART_TX_WAIT();
+            cli();
+        }
+#endif
+    }
+
+    tx_buf[tx_head] = c;
+    tx_head = next;
+    if (!(LINENIR & (1 << LENTXOK))) {
+        LINENIR |= 1 << LENTXOK;
+        tx_next();
+    }
+    SREG = sreg;
+
     return c;
 }
 
@@ -102,3 +336,49 @@ void uart_set_recv_callback(uart_recv_cb_t func)
 {
     recv_cb = func;
 }
+
+/*
+ * Hand all queued lines to the receive callback. Called from the main loop on
+ * EV_UART_RX, so further lines can be received while a command is handled.
+ */
+void uart_process(void)
+{
+    u8 sreg;
+
+    while (rx_count) {
+        if (recv_cb)
+            recv_cb(rx_lines[rx_tail]);
+        rx_tail = (rx_tail + 1) % UART_RX_LINES;
+
+        sreg = SREG;
+        cli();
+        rx_count--;
+        SREG = sreg;
+    }
+}
+
+/*
+ * Hand every received byte to func (from the Rx interrupt) instead of echoing
+ * and assembling lines, or go back to lines with NULL.
+ */
+void uart_set_raw_callback(uart_raw_cb_t func)
+{
+    rx_raw = func;
+}
+
+void uart_set_echo(bool echo)
+{
+    rx_echo = echo;
+}
+
+void uart_get_stats(struct uart_stats *ret)
+{
+    u8 sreg = SREG;
+
+    cli();
+    ret->rx_overrun = stats.rx_overrun;
+    ret->rx_overflow = stats.rx_overflow;
+    ret->rx_dropped = stats.rx_dropped;
+    ret->tx_dropped = stats.tx_dropped;
+    SREG = sreg;
+}
@@ -4,7 +4,34 @@
 #include <stdio.h>
 #include <avr/pgmspace.h>
 
+#include "types.h"
+
+/*
+ * Size of the transmit buffer (power of two). When it is full, uart_putchar()
+ * either waits for space or, if UART_TX_DROP is set, drops the byte and counts
+ * it in the tx_dropped statistic.
+ */
+#ifndef UART_TX_BUF_SIZE
+# define UART_TX_BUF_SIZE 64
+#endif
+#ifndef UART_TX_DROP
+# define UART_TX_DROP 0
+#endif
+
+/* Number of complete received lines that can be queued for uart_process(). */
+#ifndef UART_RX_LINES
+# define UART_RX_LINES 3
+#endif
+
+struct uart_stats {
+    u16 rx_overrun;  /* Bytes lost because the receiver was not serviced */
+    u16 rx_overflow; /* Lines discarded for being too long */
+    u16 rx_dropped;  /* Lines discarded because the queue was full */
+    u16 tx_dropped;  /* Bytes dropped because the Tx buffer was full */
+};
+
 typedef void (*uart_recv_cb_t)(char *msg);
+typedef void (*uart_raw_cb_t)(u8 c);
 
 extern FILE uart_fd;
 
@@ -27,6 +54,19 @@ char uart_putchar(const char c);
 int uart_fputc(const char c, FILE *stream);
 void uart_puts(const char *s);
 void uart_set_recv_callback(uart_recv_cb_t func);
+void uart_process(void);
+void uart_set_raw_callback(uart_raw_cb_t func);
+void uart_set_echo(bool echo);
+void uart_get_stats(struct uart_stats *ret);
+bool uart_tx_idle(void);
+void uart_suspend(void);
+void uart_resume(void);
+bool uart_busy(void);
+void uart_clock_changed(void);
+bool uart_clock_ok(u32 hz);
+bool uart_baud_supported(u32 rate);
+bool uart_set_baud(u32 rate);
+u32 uart_get_baud(void);
 
 
 #endif